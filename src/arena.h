@@ -0,0 +1,170 @@
+#ifndef MPI_MATRICES_ARENA_H
+#define MPI_MATRICES_ARENA_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+#include <vector>
+
+// Smallest block an arena asks the system for
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+// Most bytes of blocks an arena keeps for reuse once they are rewound past -
+// blocks beyond that go back to the system
+#define ARENA_KEEP_SIZE (16 << 20)
+
+// Monotonic memory for scratch buffers of a single operation. Allocations
+// only bump an offset through blocks taken from the system, nothing is freed
+// one by one - rewinding to a mark hands back everything allocated after it
+// at once. Blocks are kept for reuse up to ARENA_KEEP_SIZE bytes, so running
+// an operation again does not touch malloc, while a one-off large buffer
+// does not stay allocated for the life of the thread.
+class arena
+{
+public:
+	struct mark
+	{
+		size_t block;
+		size_t used;
+	};
+
+private:
+	struct block
+	{
+		char *data;
+		size_t size;
+	};
+
+	std::vector<block> blocks;
+	size_t current;
+	size_t used;
+	size_t reserved;
+
+public:
+	arena() : current(0), used(0), reserved(0)
+	{ }
+
+	~arena()
+	{
+		for (size_t b = 0; b < blocks.size(); b++)
+			free(blocks[b].data);
+	}
+
+	arena(const arena &) = delete;
+	arena &operator=(const arena &) = delete;
+
+	void *allocate(size_t bytes, size_t align)
+	{
+		// Moves on to the next kept block big enough, or takes a new one
+		while (current < blocks.size())
+		{
+			size_t offset = (used + align - 1) / align * align;
+			if (offset + bytes <= blocks[current].size)
+			{
+				used = offset + bytes;
+				return blocks[current].data + offset;
+			}
+			current++;
+			used = 0;
+		}
+		size_t size = bytes + align > ARENA_BLOCK_SIZE ? bytes + align : ARENA_BLOCK_SIZE;
+		char *data = (char *)malloc(size);
+		if (!data) throw std::bad_alloc();
+		blocks.push_back(block{data, size});
+		reserved += size;
+		current = blocks.size() - 1;
+		size_t offset = (align - (uintptr_t)data % align) % align;
+		used = offset + bytes;
+		return data + offset;
+	}
+
+	mark getMark() const
+	{ return mark{current, used}; }
+
+	// Bytes of blocks taken from the system and not given back yet
+	size_t getReserved() const
+	{ return reserved; }
+
+	// Blocks past the mark hold nothing any more - the last of them are
+	// freed while the arena keeps more than ARENA_KEEP_SIZE bytes
+	void rewind(mark m)
+	{
+		current = m.block;
+		used = m.used;
+		size_t live = m.used > 0 ? m.block + 1 : m.block;
+		while (blocks.size() > live && reserved > ARENA_KEEP_SIZE)
+		{
+			reserved -= blocks.back().size;
+			free(blocks.back().data);
+			blocks.pop_back();
+		}
+	}
+};
+
+// Arena of the calling thread, for scratch memory of kernels run by it
+inline arena &scratch_arena()
+{
+	static thread_local arena instance;
+	return instance;
+}
+
+// Hands back scratch memory taken by the thread while the scope lived.
+// Scratch containers have to be declared after the scope they use.
+class arena_scope
+{
+	arena &a;
+	arena::mark m;
+
+public:
+	arena_scope() : a(scratch_arena()), m(a.getMark())
+	{ }
+
+	~arena_scope()
+	{ a.rewind(m); }
+
+	arena_scope(const arena_scope &) = delete;
+	arena_scope &operator=(const arena_scope &) = delete;
+
+	arena &get()
+	{ return a; }
+};
+
+// Allocator placing standard containers in an arena - deallocation is left
+// to the arena
+template <typename T>
+class arena_allocator
+{
+public:
+	typedef T value_type;
+
+	arena *a;
+
+	arena_allocator(arena &a) : a(&a)
+	{ }
+
+	arena_allocator(arena_scope &scope) : a(&scope.get())
+	{ }
+
+	template <typename U>
+	arena_allocator(const arena_allocator<U> &other) : a(other.a)
+	{ }
+
+	T *allocate(size_t n)
+	{ return static_cast<T *>(a->allocate(n * sizeof(T), alignof(T))); }
+
+	void deallocate(T *, size_t)
+	{ }
+
+	template <typename U>
+	bool operator==(const arena_allocator<U> &other) const
+	{ return a == other.a; }
+
+	template <typename U>
+	bool operator!=(const arena_allocator<U> &other) const
+	{ return a != other.a; }
+};
+
+template <typename T>
+using scratch_vector = std::vector<T, arena_allocator<T>>;
+
+#endif //MPI_MATRICES_ARENA_H
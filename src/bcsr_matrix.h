@@ -0,0 +1,337 @@
+#ifndef MPI_MATRICES_BCSR_MATRIX_H
+#define MPI_MATRICES_BCSR_MATRIX_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include "sparse_matrix.h"
+#include "dense_vector.h"
+
+// Block rows handed out to a thread at a time in SpGEMM
+#define BCSR_SPGEMM_CHUNK 16
+
+// Block compressed rows: the matrix is cut into R x C blocks and every block
+// with a nonzero is kept whole, row after row, with one column index per
+// block. Block sizes are template arguments, so loops over a block are
+// fully unrolled by the compiler. Blocks sticking out of the matrix when its
+// sizes are not multiples of R or C are padded with zeros.
+template <int R, int C>
+class bcsr_matrix
+{
+// FIELDS
+private:
+	int width;
+	int height;
+	int block_rows;
+	int block_cols;
+
+	// Block row I keeps block columns idx[ptr[I]..ptr[I+1]) sorted ascending,
+	// block k at values[k * R * C] stored row after row
+	std::vector<sparse_offset> ptr;
+	std::vector<int> idx;
+	std::vector<double> values;
+
+	template <int, int> friend class bcsr_matrix;
+
+// CONSTRUCTORS
+public:
+	bcsr_matrix() : width(0), height(0), block_rows(0), block_cols(0), ptr(1, 0)
+	{ }
+
+	explicit bcsr_matrix(const sparse_matrix &m);
+
+private:
+	bcsr_matrix(int width, int height)
+			: width(width), height(height),
+			  block_rows((height + R - 1) / R), block_cols((width + C - 1) / C),
+			  ptr(block_rows + 1, 0)
+	{ }
+
+// OPERATORS
+public:
+	dense_vector operator*(const dense_vector &v) const
+	{ return multiply(v, 1); }
+
+	template <int K>
+	bcsr_matrix<R, K> operator*(const bcsr_matrix<C, K> &m) const
+	{ return multiply(m, 1); }
+
+// METHODS
+public:
+	dense_vector multiply(const dense_vector &v, int threads) const;
+	template <int K>
+	bcsr_matrix<R, K> multiply(const bcsr_matrix<C, K> &m, int threads) const;
+	sparse_matrix toSparse(direction d = column_wise) const;
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	sparse_offset getBlockCount() const { return idx.size(); }
+};
+
+// MICRO-KERNELS
+
+// y += A * x for one R x C block
+template <int R, int C>
+static inline void bcsr_block_mv(const double *a, const double *x, double *y)
+{
+	for (int r = 0; r < R; r++)
+	{
+		double acc = y[r];
+		for (int c = 0; c < C; c++)
+			acc += a[r * C + c] * x[c];
+		y[r] = acc;
+	}
+}
+
+// Z += A * B for R x C block A and C x K block B
+template <int R, int C, int K>
+static inline void bcsr_block_mm(const double *a, const double *b, double *z)
+{
+	for (int r = 0; r < R; r++)
+		for (int k = 0; k < K; k++)
+		{
+			double acc = z[r * K + k];
+			for (int c = 0; c < C; c++)
+				acc += a[r * C + c] * b[c * K + k];
+			z[r * K + k] = acc;
+		}
+}
+
+// IMPLEMENTATION
+
+template <int R, int C>
+bcsr_matrix<R, C>::bcsr_matrix(const sparse_matrix &m)
+		: bcsr_matrix(m.getWidth(), m.getHeight())
+{
+	// Items are read row by row
+	sparse_matrix row_matrix(m.isSymmetric() ? m.toGeneral() : m.toDir(row_wise));
+	if (row_matrix.getDir() != row_wise) row_matrix.toggleDir();
+	auto &m_ptr = row_matrix.getPtr();
+	auto &m_idx = row_matrix.getIdx();
+	auto &m_values = row_matrix.getValues();
+
+	// slot[J] - position of block column J in the current block row
+	std::vector<sparse_offset> slot(block_cols, -1);
+	for (int I = 0; I < block_rows; I++)
+	{
+		sparse_offset begin = idx.size();
+		int last = std::min((I + 1) * R, height);
+		for (int i = I * R; i < last; i++)
+			for (sparse_offset k = m_ptr[i]; k < m_ptr[i + 1]; k++)
+				if (slot[m_idx[k] / C] < 0)
+				{
+					slot[m_idx[k] / C] = 0;
+					idx.push_back(m_idx[k] / C);
+				}
+		std::sort(idx.begin() + begin, idx.end());
+		for (sparse_offset k = begin; k < (sparse_offset)idx.size(); k++)
+			slot[idx[k]] = k;
+
+		values.resize(idx.size() * R * C, 0.0);
+		for (int i = I * R; i < last; i++)
+			for (sparse_offset k = m_ptr[i]; k < m_ptr[i + 1]; k++)
+				values[(size_t)slot[m_idx[k] / C] * R * C + (i - I * R) * C + m_idx[k] % C] = m_values[k];
+
+		for (sparse_offset k = begin; k < (sparse_offset)idx.size(); k++)
+			slot[idx[k]] = -1;
+		ptr[I + 1] = idx.size();
+	}
+}
+
+template <int R, int C>
+dense_vector bcsr_matrix<R, C>::multiply(const dense_vector &v, int threads) const
+{
+	if (v.size() != width)
+		throw std::runtime_error("Dimensions of matrix and vector do not match");
+
+	dense_vector result(height, v.getDir());
+	double *y = result.getData();
+
+	// Blocks sticking out of the matrix read zeros past the end of x
+	std::vector<double> padded;
+	const double *x = v.getData();
+	if (width % C)
+	{
+		padded.assign((size_t)block_cols * C, 0.0);
+		std::copy(x, x + width, padded.begin());
+		x = padded.data();
+	}
+
+	#pragma omp parallel for num_threads(threads) schedule(static) if(threads > 1)
+	for (int I = 0; I < block_rows; I++)
+	{
+		double acc[R] = { };
+		for (sparse_offset k = ptr[I]; k < ptr[I + 1]; k++)
+			bcsr_block_mv<R, C>(values.data() + (size_t)k * R * C, x + idx[k] * C, acc);
+		int rows = std::min(R, height - I * R);
+		for (int r = 0; r < rows; r++)
+			y[I * R + r] = acc[r];
+	}
+
+	return result;
+}
+
+// Gustavson's product over block rows: block row I of the result sums block
+// rows K of m scaled by blocks (I, K) of this. A symbolic pass sizes every
+// block row, then a dense accumulator of blocks collects it.
+template <int R, int C>
+template <int K>
+bcsr_matrix<R, K> bcsr_matrix<R, C>::multiply(const bcsr_matrix<C, K> &m, int threads) const
+{
+	if (width != m.height)
+		throw std::runtime_error("Dimensions of matrices do not match");
+
+	bcsr_matrix<R, K> result(m.width, height);
+	int n = block_rows, cols = m.block_cols;
+	std::vector<int> count(n, 0);
+
+	// Symbolic pass
+	#pragma omp parallel num_threads(threads) if(threads > 1)
+	{
+		std::vector<int> mark(cols, -1);
+		#pragma omp for schedule(dynamic, BCSR_SPGEMM_CHUNK)
+		for (int I = 0; I < n; I++)
+		{
+			int c = 0;
+			for (sparse_offset l = ptr[I]; l < ptr[I + 1]; l++)
+			{
+				int k = idx[l];
+				for (sparse_offset t = m.ptr[k]; t < m.ptr[k + 1]; t++)
+					if (mark[m.idx[t]] != I)
+					{
+						mark[m.idx[t]] = I;
+						c++;
+					}
+			}
+			count[I] = c;
+		}
+	}
+
+	for (int I = 0; I < n; I++)
+		result.ptr[I + 1] = result.ptr[I] + count[I];
+	result.idx.resize(result.ptr[n]);
+	result.values.assign((size_t)result.ptr[n] * R * K, 0.0);
+
+	// Numeric pass
+	#pragma omp parallel num_threads(threads) if(threads > 1)
+	{
+		std::vector<int> mark(cols, -1);
+		std::vector<double> acc((size_t)cols * R * K);
+		#pragma omp for schedule(dynamic, BCSR_SPGEMM_CHUNK)
+		for (int I = 0; I < n; I++)
+		{
+			sparse_offset begin = result.ptr[I];
+			int c = 0;
+			for (sparse_offset l = ptr[I]; l < ptr[I + 1]; l++)
+			{
+				int k = idx[l];
+				const double *a = values.data() + (size_t)l * R * C;
+				for (sparse_offset t = m.ptr[k]; t < m.ptr[k + 1]; t++)
+				{
+					int J = m.idx[t];
+					double *z = acc.data() + (size_t)J * R * K;
+					if (mark[J] != I)
+					{
+						mark[J] = I;
+						result.idx[begin + c++] = J;
+						std::fill(z, z + R * K, 0.0);
+					}
+					bcsr_block_mm<R, C, K>(a, m.values.data() + (size_t)t * C * K, z);
+				}
+			}
+			std::sort(result.idx.begin() + begin, result.idx.begin() + begin + c);
+			for (int l = 0; l < c; l++)
+			{
+				const double *z = acc.data() + (size_t)result.idx[begin + l] * R * K;
+				std::copy(z, z + R * K, result.values.begin() + (size_t)(begin + l) * R * K);
+			}
+		}
+	}
+
+	return result;
+}
+
+template <int R, int C>
+sparse_matrix bcsr_matrix<R, C>::toSparse(direction d) const
+{
+	std::vector<sparse_matrix_elem> elements;
+	for (int I = 0; I < block_rows; I++)
+		for (sparse_offset k = ptr[I]; k < ptr[I + 1]; k++)
+			for (int r = 0; r < R; r++)
+				for (int c = 0; c < C; c++)
+				{
+					double value = values[(size_t)k * R * C + r * C + c];
+					if (value != 0)
+						elements.push_back(sparse_matrix_elem{idx[k] * C + c, I * R + r, value});
+				}
+	return sparse_matrix::fromElements(std::move(elements), width, height, d);
+}
+
+// BLOCK SIZE CHOSEN AT RUN TIME
+
+// Square blocks of a size known only at run time, such as the one detected
+// in a loaded matrix. Every size detectBlockSize can give maps to its own
+// bcsr_matrix instantiation behind this interface, so the kernels stay
+// unrolled.
+class block_matrix
+{
+public:
+	virtual ~block_matrix() { }
+
+	virtual int getBlockSize() const = 0;
+	virtual int getWidth() const = 0;
+	virtual int getHeight() const = 0;
+	virtual sparse_offset getBlockCount() const = 0;
+	virtual dense_vector multiply(const dense_vector &v, int threads = 1) const = 0;
+	virtual sparse_matrix toSparse(direction d = column_wise) const = 0;
+
+	// m cut into b x b blocks
+	static std::unique_ptr<block_matrix> create(const sparse_matrix &m, int b);
+	// m cut into blocks of the size detected in it
+	static std::unique_ptr<block_matrix> create(const sparse_matrix &m)
+	{ return create(m, m.detectBlockSize()); }
+	// Matrix of a sparse file, read as sparse_matrix::fromSparseFile does,
+	// in blocks of the size detected in it
+	static std::unique_ptr<block_matrix> fromSparseFile(const char *name, int offset = 0, bool symmetric = false)
+	{ return create(sparse_matrix::fromSparseFile(name, row_wise, offset, symmetric)); }
+};
+
+template <int B>
+class square_bcsr_matrix : public block_matrix
+{
+private:
+	bcsr_matrix<B, B> m;
+
+public:
+	explicit square_bcsr_matrix(const sparse_matrix &s) : m(s)
+	{ }
+
+	const bcsr_matrix<B, B> &matrix() const { return m; }
+
+	int getBlockSize() const { return B; }
+	int getWidth() const { return m.getWidth(); }
+	int getHeight() const { return m.getHeight(); }
+	sparse_offset getBlockCount() const { return m.getBlockCount(); }
+
+	dense_vector multiply(const dense_vector &v, int threads = 1) const
+	{ return m.multiply(v, threads); }
+
+	sparse_matrix toSparse(direction d = column_wise) const
+	{ return m.toSparse(d); }
+};
+
+inline std::unique_ptr<block_matrix> block_matrix::create(const sparse_matrix &m, int b)
+{
+	switch (b)
+	{
+		case 1: return std::unique_ptr<block_matrix>(new square_bcsr_matrix<1>(m));
+		case 2: return std::unique_ptr<block_matrix>(new square_bcsr_matrix<2>(m));
+		case 3: return std::unique_ptr<block_matrix>(new square_bcsr_matrix<3>(m));
+		case 4: return std::unique_ptr<block_matrix>(new square_bcsr_matrix<4>(m));
+		case 6: return std::unique_ptr<block_matrix>(new square_bcsr_matrix<6>(m));
+		default: throw std::runtime_error("Unsupported block size");
+	}
+}
+
+#endif //MPI_MATRICES_BCSR_MATRIX_H
@@ -1,23 +1,249 @@
 #include "dense_matrix.h"
+#include "simd.h"
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
 
-dense_matrix dense_matrix::operator+(const dense_matrix &m)
+// GEMM blocking: an MR x NR tile of C lives in registers, an MC x KC block
+// of A is packed to stay in L2 and a KC x NC panel of B is packed for L3
+#if defined(__AVX512F__)
+    #define GEMM_MR 16
+    #define GEMM_NR 8
+#elif defined(__AVX2__)
+    #define GEMM_MR 8
+    #define GEMM_NR 6
+#else
+    #define GEMM_MR 4
+    #define GEMM_NR 4
+#endif
+#define GEMM_MC 192
+#define GEMM_KC 256
+#define GEMM_NC 1024
+
+#define DOUBLES_PER_LINE (SIMD_ALIGNMENT / sizeof(double))
+
+dense_matrix::dense_matrix() : data(nullptr), ld(0), height(0), width(0)
+{ }
+
+dense_matrix::dense_matrix(int width, int height) : data(nullptr)
+{
+    allocate(width, height);
+}
+
+dense_matrix::dense_matrix(vector<sparse_matrix_elem> elements) : data(nullptr)
+{
+    int w = 0, h = 0;
+    for (auto it = elements.begin(); it != elements.end(); it++)
+    {
+        if (it->row + 1 > h) h = it->row + 1;
+        if (it->col + 1 > w) w = it->col + 1;
+    }
+    allocate(w, h);
+    initData(elements);
+}
+
+dense_matrix::dense_matrix(const sparse_matrix& matrix) : data(nullptr)
+{
+    allocate(matrix.getWidth(), matrix.getHeight());
+    initData(matrix.getRawData());
+}
+
+dense_matrix::dense_matrix(const dense_matrix& m) : data(nullptr)
+{
+    allocate(m.width, m.height);
+    if (data) memcpy(data, m.data, (size_t)ld * width * sizeof(double));
+}
+
+dense_matrix::dense_matrix(dense_matrix&& m) : data(m.data), ld(m.ld), height(m.height), width(m.width)
+{
+    m.data = nullptr;
+    m.ld = m.width = m.height = 0;
+}
+
+dense_matrix::~dense_matrix()
+{
+    simd_free(data);
+}
+
+dense_matrix& dense_matrix::operator=(const dense_matrix& m)
+{
+    if (this == &m) return *this;
+    dense_matrix tmp(m);
+    return *this = std::move(tmp);
+}
+
+dense_matrix& dense_matrix::operator=(dense_matrix&& m)
+{
+    std::swap(data, m.data);
+    std::swap(ld, m.ld);
+    std::swap(width, m.width);
+    std::swap(height, m.height);
+    return *this;
+}
+
+void dense_matrix::allocate(int w, int h)
 {
-    dense_matrix result(width, height);
-    for(int i = 0; i < width; i++)
-        for(int j = 0; j < height; j++)
-            result.data[i][j] = data[i][j] + m.data[i][j];
+    width = w;
+    height = h;
+    ld = ((h + DOUBLES_PER_LINE - 1) / DOUBLES_PER_LINE) * DOUBLES_PER_LINE;
+    data = simd_alloc((size_t)ld * w);
+    if (data) memset(data, 0, (size_t)ld * w * sizeof(double));
+}
+
+void dense_matrix::initData(const vector<sparse_matrix_elem> &elements)
+{
+    for (auto it = elements.begin(); it != elements.end(); it++)
+        (*this)(it->row, it->col) = it->value;
+}
+
+dense_matrix dense_matrix::operator+(const dense_matrix &m) const
+{
+    if (width != m.width || height != m.height)
+        throw std::runtime_error("Dimensions of matrices do not match");
+    dense_matrix result(*this);
+    size_t n = (size_t)ld * width;
+    for (size_t i = 0; i < n; i++)
+        result.data[i] += m.data[i];
     return result;
 }
 
-dense_matrix dense_matrix::operator*(const dense_matrix &m)
+// Copies mc x kc block of A into MR row slivers, each stored p-major so the
+// micro kernel reads MR consecutive values per step. Rows past mc are zero.
+static void pack_a(int mc, int kc, const double *a, int lda, double *packed)
+{
+    for (int ir = 0; ir < mc; ir += GEMM_MR)
+    {
+        int mr = std::min(GEMM_MR, mc - ir);
+        for (int p = 0; p < kc; p++)
+        {
+            const double *column = a + (size_t)p * lda + ir;
+            for (int i = 0; i < mr; i++) packed[i] = column[i];
+            for (int i = mr; i < GEMM_MR; i++) packed[i] = 0;
+            packed += GEMM_MR;
+        }
+    }
+}
+
+// Copies kc x nc panel of B into NR column slivers, NR values per step
+static void pack_b(int kc, int nc, const double *b, int ldb, double *packed)
+{
+    for (int jr = 0; jr < nc; jr += GEMM_NR)
+    {
+        int nr = std::min(GEMM_NR, nc - jr);
+        for (int p = 0; p < kc; p++)
+        {
+            for (int j = 0; j < nr; j++) packed[j] = b[(size_t)(jr + j) * ldb + p];
+            for (int j = nr; j < GEMM_NR; j++) packed[j] = 0;
+            packed += GEMM_NR;
+        }
+    }
+}
+
+// C[0:mr, 0:nr] += A_sliver * B_sliver, accumulating the whole tile in registers
+static void micro_kernel(int kc, const double *a, const double *b, double *c, int ldc, int mr, int nr)
+{
+    alignas(SIMD_ALIGNMENT) double tile[GEMM_MR * GEMM_NR];
+#ifdef SIMD_WIDTH
+    const int V = GEMM_MR / SIMD_WIDTH;
+    simd_t acc[V][GEMM_NR];
+    for (int j = 0; j < GEMM_NR; j++)
+        for (int v = 0; v < V; v++)
+            acc[v][j] = simd_zero();
+
+    for (int p = 0; p < kc; p++, a += GEMM_MR, b += GEMM_NR)
+    {
+        simd_t av[V];
+        for (int v = 0; v < V; v++)
+            av[v] = simd_load(a + v * SIMD_WIDTH);
+        for (int j = 0; j < GEMM_NR; j++)
+        {
+            simd_t bj = simd_set1(b[j]);
+            for (int v = 0; v < V; v++)
+                acc[v][j] = simd_fmadd(av[v], bj, acc[v][j]);
+        }
+    }
+
+    if (mr == GEMM_MR && nr == GEMM_NR)
+    {
+        // Full tile - columns of C are aligned, update them in place
+        for (int j = 0; j < GEMM_NR; j++)
+            for (int v = 0; v < V; v++)
+            {
+                double *cj = c + (size_t)j * ldc + v * SIMD_WIDTH;
+                simd_store(cj, simd_add(simd_load(cj), acc[v][j]));
+            }
+        return;
+    }
+    for (int j = 0; j < GEMM_NR; j++)
+        for (int v = 0; v < V; v++)
+            simd_store(tile + j * GEMM_MR + v * SIMD_WIDTH, acc[v][j]);
+#else
+    for (int i = 0; i < GEMM_MR * GEMM_NR; i++) tile[i] = 0;
+    for (int p = 0; p < kc; p++, a += GEMM_MR, b += GEMM_NR)
+        for (int j = 0; j < GEMM_NR; j++)
+            for (int i = 0; i < GEMM_MR; i++)
+                tile[j * GEMM_MR + i] += a[i] * b[j];
+#endif
+    for (int j = 0; j < nr; j++)
+        for (int i = 0; i < mr; i++)
+            c[(size_t)j * ldc + i] += tile[j * GEMM_MR + i];
+}
+
+// C += A * B for column major M x K matrix A and K x N matrix B
+static void gemm(int M, int N, int K, const double *A, int lda, const double *B, int ldb,
+                 double *C, int ldc, int threads)
+{
+    int nc_max = std::min(GEMM_NC, N);
+    double *packed_b = simd_alloc((size_t)GEMM_KC * ((nc_max + GEMM_NR - 1) / GEMM_NR) * GEMM_NR);
+
+    for (int jc = 0; jc < N; jc += GEMM_NC)
+    {
+        int nc = std::min(GEMM_NC, N - jc);
+        for (int pc = 0; pc < K; pc += GEMM_KC)
+        {
+            int kc = std::min(GEMM_KC, K - pc);
+            pack_b(kc, nc, B + (size_t)jc * ldb + pc, ldb, packed_b);
+
+            // Blocks of rows of C are independent - threads share packed B
+            #pragma omp parallel num_threads(threads) if(threads > 1)
+            {
+                double *packed_a = simd_alloc((size_t)GEMM_MC * GEMM_KC);
+
+                #pragma omp for schedule(dynamic)
+                for (int ic = 0; ic < M; ic += GEMM_MC)
+                {
+                    int mc = std::min(GEMM_MC, M - ic);
+                    pack_a(mc, kc, A + (size_t)pc * lda + ic, lda, packed_a);
+                    for (int jr = 0; jr < nc; jr += GEMM_NR)
+                        for (int ir = 0; ir < mc; ir += GEMM_MR)
+                            micro_kernel(kc, packed_a + (size_t)ir * kc, packed_b + (size_t)jr * kc,
+                                         C + (size_t)(jc + jr) * ldc + ic + ir, ldc,
+                                         std::min(GEMM_MR, mc - ir), std::min(GEMM_NR, nc - jr));
+                }
+
+                simd_free(packed_a);
+            }
+        }
+    }
+
+    simd_free(packed_b);
+}
+
+dense_matrix dense_matrix::operator*(const dense_matrix &m) const
+{
+    return multiply(m, 1);
+}
+
+dense_matrix dense_matrix::multiply(const dense_matrix &m, int threads) const
 {
+    if (width != m.height)
+        throw std::runtime_error("Dimensions of matrices do not match");
     dense_matrix result(m.width, height);
-    for(int i = 0; i < m.width; i++)
-        for(int j = 0; j < height; j++)
-            for(int k = 0; k < width; k++)
-                result.data[i][j] += data[k][j] * m.data[i][k];
+    if (height && m.width && width)
+        gemm(height, m.width, width, data, ld, m.data, m.ld, result.data, result.ld, threads);
     return result;
 }
 
@@ -40,27 +266,29 @@ bool AlmostEqual2sComplement(float A, float B, int maxUlps = 4)
     return false;
 }
 
-bool operator== (dense_matrix &m1, dense_matrix &m2)
+bool operator== (const dense_matrix &m1, const dense_matrix &m2)
 {
+    if (m1.width != m2.width || m1.height != m2.height)
+        return false;
     for(int i = 0; i < m1.width; i++)
       for(int j = 0; j < m1.height; j++)
-        if(!AlmostEqual2sComplement(m1.data[i][j], m2.data[i][j]))
+        if(!AlmostEqual2sComplement(m1(j, i), m2(j, i)))
           return false;
     return true;
 }
 
-bool operator!= (dense_matrix &m1, dense_matrix &m2)
+bool operator!= (const dense_matrix &m1, const dense_matrix &m2)
 {
     return !(m1 == m2);
 }
 
-void dense_matrix::printDense()
+void dense_matrix::printDense() const
 {
     for(int j = 0; j < height; j++)
     {
         for(int i = 0; i < width; i++)
         {
-          printf("\t%.2f", data[i][j]);
+          printf("\t%.2f", (*this)(j, i));
         }
         printf("\n");
     }
@@ -14,74 +14,44 @@
 
 using namespace std;
 
+// Column major matrix kept in one 64-byte aligned buffer. Every column is
+// padded to a whole number of cache lines (ld doubles) so columns stay aligned.
 class dense_matrix
 {
+private:
+  double* data;
+  int ld;
+
 public:
-  double** data;
   int height;
   int width;
 
-  dense_matrix(){}
-  dense_matrix(int width, int height) : width(width), height(height)
-  {
-    initEmptyData();
-  }
-  dense_matrix(vector<sparse_matrix_elem> elements)
-  {
-    initSize(elements);
-    initEmptyData();
-    initData(elements);
-  }
-  dense_matrix(const sparse_matrix& matrix)
-  {
-    width = matrix.getWidth();
-    height = matrix.getHeight();
-    initEmptyData();
-    initData(matrix.getRawData());
-  }
-  ~dense_matrix(){}
-  dense_matrix(const dense_matrix& m)
-  {
-    data = m.data;
-    height = m.height;
-    width = m.width;
-  }
-
-  void initSize(vector<sparse_matrix_elem> elements)
-  {
-    height=0;
-    width=0;
-    for (auto it=elements.begin(); it != elements.end(); it++)
-    {
-      if(it->row+1 > height) height = it->row+1;
-      if(it->col+1 > width) width = it->col+1;
-    }
-  }
+  dense_matrix();
+  dense_matrix(int width, int height);
+  dense_matrix(vector<sparse_matrix_elem> elements);
+  dense_matrix(const sparse_matrix& matrix);
+  dense_matrix(const dense_matrix& m);
+  dense_matrix(dense_matrix&& m);
+  ~dense_matrix();
 
-  void initData(vector<sparse_matrix_elem> elements)
-  {
-    for (auto it=elements.begin(); it != elements.end(); it++)
-      data[it->col][it->row] = it->value;
-  }
+  dense_matrix& operator=(const dense_matrix& m);
+  dense_matrix& operator=(dense_matrix&& m);
 
-  void initEmptyData()
-  {
-    data = new double*[width];
-    for(int i = 0; i < width; i++)
-      data[i] = new double[height];
+  double& operator()(int row, int col) { return data[col * ld + row]; }
+  const double& operator()(int row, int col) const { return data[col * ld + row]; }
 
-    for(int i = 0; i < width; i++)
-      for(int j = 0; j < height; j++)
-        data[i][j] = 0;
-  }
+  void printDense() const;
 
-  void printDense();
+  dense_matrix operator+(const dense_matrix &m) const;
+  dense_matrix operator*(const dense_matrix &m) const;
+  dense_matrix multiply(const dense_matrix &m, int threads) const;
 
-  dense_matrix operator+(const dense_matrix &m);
-  dense_matrix operator*(const dense_matrix &m);
+  friend bool operator== (const dense_matrix &m1, const dense_matrix &m2);
+  friend bool operator!= (const dense_matrix &m1, const dense_matrix &m2);
 
-  friend bool operator== (dense_matrix &m1, dense_matrix &m2);
-  friend bool operator!= (dense_matrix &m1, dense_matrix &m2);
+private:
+  void allocate(int w, int h);
+  void initData(const vector<sparse_matrix_elem> &elements);
 };
 
 
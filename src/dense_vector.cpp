@@ -0,0 +1,209 @@
+#include "dense_vector.h"
+#include "simd.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdexcept>
+#include <utility>
+
+// CONSTRUCTORS
+
+dense_vector::dense_vector() : data(nullptr), length(0), dir(column_wise)
+{ }
+
+dense_vector::dense_vector(int len, direction dir) : data(simd_alloc(len)), length(len), dir(dir)
+{ fill(0); }
+
+dense_vector::dense_vector(const dense_vector &other)
+		: data(simd_alloc(other.length)), length(other.length), dir(other.dir)
+{
+	if (length) memcpy(data, other.data, length * sizeof(double));
+}
+
+dense_vector::dense_vector(dense_vector &&other)
+		: data(other.data), length(other.length), dir(other.dir)
+{
+	other.data = nullptr;
+	other.length = 0;
+}
+
+dense_vector::~dense_vector()
+{ simd_free(data); }
+
+dense_vector &dense_vector::operator=(const dense_vector &other)
+{
+	if (this == &other) return *this;
+	dense_vector tmp(other);
+	return *this = std::move(tmp);
+}
+
+dense_vector &dense_vector::operator=(dense_vector &&other)
+{
+	std::swap(data, other.data);
+	std::swap(length, other.length);
+	dir = other.dir;
+	return *this;
+}
+
+// GETTERS AND SETTERS
+
+int dense_vector::size() const
+{ return length; }
+
+direction dense_vector::getDir() const
+{ return dir; }
+
+double *dense_vector::getData()
+{ return data; }
+
+const double *dense_vector::getData() const
+{ return data; }
+
+// KERNELS
+
+// Single threaded kernels over n elements starting at aligned addresses
+
+static void axpy_kernel(double a, const double *x, double *y, int n)
+{
+	int i = 0;
+#ifdef SIMD_WIDTH
+	simd_t va = simd_set1(a);
+	for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH)
+		simd_store(y + i, simd_fmadd(va, simd_load(x + i), simd_load(y + i)));
+#endif
+	for (; i < n; i++)
+		y[i] += a * x[i];
+}
+
+static void axpby_kernel(double a, const double *x, double b, double *y, int n)
+{
+	int i = 0;
+#ifdef SIMD_WIDTH
+	simd_t va = simd_set1(a);
+	simd_t vb = simd_set1(b);
+	for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH)
+		simd_store(y + i, simd_fmadd(va, simd_load(x + i), simd_mul(vb, simd_load(y + i))));
+#endif
+	for (; i < n; i++)
+		y[i] = a * x[i] + b * y[i];
+}
+
+static void scal_kernel(double a, double *y, int n)
+{
+	int i = 0;
+#ifdef SIMD_WIDTH
+	simd_t va = simd_set1(a);
+	for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH)
+		simd_store(y + i, simd_mul(va, simd_load(y + i)));
+#endif
+	for (; i < n; i++)
+		y[i] *= a;
+}
+
+static double dot_kernel(const double *x, const double *y, int n)
+{
+	double acc = 0.;
+	int i = 0;
+#ifdef SIMD_WIDTH
+	// Two independent accumulators hide the FMA latency
+	simd_t acc0 = simd_zero(), acc1 = simd_zero();
+	for (; i + 2 * SIMD_WIDTH <= n; i += 2 * SIMD_WIDTH)
+	{
+		acc0 = simd_fmadd(simd_load(x + i), simd_load(y + i), acc0);
+		acc1 = simd_fmadd(simd_load(x + i + SIMD_WIDTH), simd_load(y + i + SIMD_WIDTH), acc1);
+	}
+	acc = simd_hsum(simd_add(acc0, acc1));
+#endif
+	for (; i < n; i++)
+		acc += x[i] * y[i];
+	return acc;
+}
+
+// Vectors shorter than that are not worth waking up other threads
+#define PARALLEL_MIN_LENGTH 16384
+
+// Start of chunk t out of n - rounded down to a whole cache line, so that
+// every chunk starts aligned and no two threads write the same line
+static int chunk_begin(int length, int t, int n)
+{
+	if (t == n) return length;
+	const int line = SIMD_ALIGNMENT / sizeof(double);
+	return (int)((long long)length * t / n) / line * line;
+}
+
+static int use_threads(int length, int threads)
+{
+	return length < PARALLEL_MIN_LENGTH ? 1 : threads;
+}
+
+// this = this + a * x
+void dense_vector::axpy(double a, const dense_vector &x, int threads)
+{
+	assert(length == x.length);
+	threads = use_threads(length, threads);
+	#pragma omp parallel for num_threads(threads) schedule(static, 1) if(threads > 1)
+	for (int t = 0; t < threads; t++)
+	{
+		int begin = chunk_begin(length, t, threads);
+		axpy_kernel(a, x.data + begin, data + begin, chunk_begin(length, t + 1, threads) - begin);
+	}
+}
+
+// this = a * x + b * this
+void dense_vector::axpby(double a, const dense_vector &x, double b, int threads)
+{
+	assert(length == x.length);
+	threads = use_threads(length, threads);
+	#pragma omp parallel for num_threads(threads) schedule(static, 1) if(threads > 1)
+	for (int t = 0; t < threads; t++)
+	{
+		int begin = chunk_begin(length, t, threads);
+		axpby_kernel(a, x.data + begin, b, data + begin, chunk_begin(length, t + 1, threads) - begin);
+	}
+}
+
+void dense_vector::scal(double a, int threads)
+{
+	threads = use_threads(length, threads);
+	#pragma omp parallel for num_threads(threads) schedule(static, 1) if(threads > 1)
+	for (int t = 0; t < threads; t++)
+	{
+		int begin = chunk_begin(length, t, threads);
+		scal_kernel(a, data + begin, chunk_begin(length, t + 1, threads) - begin);
+	}
+}
+
+double dense_vector::dot(const dense_vector &other, int threads) const
+{
+	assert(length == other.length);
+	threads = use_threads(length, threads);
+	double acc = 0.;
+	#pragma omp parallel for num_threads(threads) schedule(static, 1) reduction(+:acc) if(threads > 1)
+	for (int t = 0; t < threads; t++)
+	{
+		int begin = chunk_begin(length, t, threads);
+		acc += dot_kernel(data + begin, other.data + begin, chunk_begin(length, t + 1, threads) - begin);
+	}
+	return acc;
+}
+
+double dense_vector::l2_norm(int threads) const
+{
+	return sqrt(dot(*this, threads));
+}
+
+// UTILITY
+
+void dense_vector::fill(double value)
+{
+	for (int i = 0; i < length; i++)
+		data[i] = value;
+}
+
+void dense_vector::print() const
+{
+	for (int i = 0; i < length; i++)
+		printf("(%d)=>%f", i, data[i]);
+	printf("\n");
+}
@@ -0,0 +1,84 @@
+#ifndef MPI_MATRICES_DENSE_VECTOR_H
+#define MPI_MATRICES_DENSE_VECTOR_H
+
+#include "direction.h"
+#include "sparse_vector.h"
+
+// Contiguous vector for iterates of Krylov solvers, which become dense after
+// the first iteration anyway. Storage is 64-byte aligned and the BLAS-like
+// kernels below are vectorized with AVX2/AVX-512 when compiled for them.
+class dense_vector
+{
+// FIELDS
+private:
+	double *data;
+	int length;
+	direction dir;
+
+// CONSTRUCTORS
+public:
+	dense_vector();
+	dense_vector(int len, direction dir = column_wise);
+	template <typename V, typename I>
+	explicit dense_vector(const basic_sparse_vector<V, I> &v);
+	dense_vector(const dense_vector &other);
+	dense_vector(dense_vector &&other);
+	~dense_vector();
+
+// OPERATORS
+public:
+	dense_vector &operator=(const dense_vector &other);
+	dense_vector &operator=(dense_vector &&other);
+
+	double &operator[](int el);
+	const double &operator[](int el) const;
+
+	dense_vector operator+(const dense_vector &v) const;
+	dense_vector operator-(const dense_vector &v) const;
+	dense_vector operator*(const double &d) const;
+
+	dense_vector &operator+=(const dense_vector &v);
+	dense_vector &operator-=(const dense_vector &v);
+	dense_vector &operator*=(const double &d);
+
+// GETTERS AND SETTERS
+public:
+	int size() const;
+	direction getDir() const;
+	double *getData();
+	const double *getData() const;
+
+// METHODS
+public:
+	// KERNELS - threads > 1 splits long vectors into per-thread chunks
+	void axpy(double a, const dense_vector &x, int threads = 1);
+	void axpby(double a, const dense_vector &x, double b, int threads = 1);
+	void scal(double a, int threads = 1);
+	double dot(const dense_vector &other, int threads = 1) const;
+	double l2_norm(int threads = 1) const;
+
+	// UTILITY
+	void fill(double value);
+	void print() const;
+	template <typename V = double, typename I = int>
+	basic_sparse_vector<V, I> toSparse() const;
+};
+
+template <typename V, typename I>
+dense_vector::dense_vector(const basic_sparse_vector<V, I> &v)
+		: dense_vector(v.size(), v.getDir())
+{
+	for (auto it = v.cbegin(); it != v.cend(); it++)
+		data[it->first] = it->second;
+}
+
+template <typename V, typename I>
+basic_sparse_vector<V, I> dense_vector::toSparse() const
+{
+	basic_sparse_vector<V, I> result(length, dir);
+	for (int i = 0; i < length; i++)
+		result.append(i, data[i]);
+	return result;
+}
+
+#endif //MPI_MATRICES_DENSE_VECTOR_H
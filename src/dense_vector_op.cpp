@@ -0,0 +1,49 @@
+#include "dense_vector.h"
+#include <stdexcept>
+
+double &dense_vector::operator[](int el)
+{ return data[el]; }
+
+const double &dense_vector::operator[](int el) const
+{ return data[el]; }
+
+dense_vector dense_vector::operator+(const dense_vector &v) const
+{
+	if (length != v.length) throw std::runtime_error("size of vectors must match!");
+	dense_vector result(*this);
+	result.axpy(1.0, v);
+	return result;
+}
+
+dense_vector dense_vector::operator-(const dense_vector &v) const
+{
+	if (length != v.length) throw std::runtime_error("size of vectors must match!");
+	dense_vector result(*this);
+	result.axpy(-1.0, v);
+	return result;
+}
+
+dense_vector dense_vector::operator*(const double &d) const
+{
+	dense_vector result(*this);
+	result.scal(d);
+	return result;
+}
+
+dense_vector &dense_vector::operator+=(const dense_vector &v)
+{
+	axpy(1.0, v);
+	return *this;
+}
+
+dense_vector &dense_vector::operator-=(const dense_vector &v)
+{
+	axpy(-1.0, v);
+	return *this;
+}
+
+dense_vector &dense_vector::operator*=(const double &d)
+{
+	scal(d);
+	return *this;
+}
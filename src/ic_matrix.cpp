@@ -0,0 +1,144 @@
+#include "ic_matrix.h"
+#include "arena.h"
+#include <stdexcept>
+#include <math.h>
+
+// CONSTRUCTORS
+
+template <typename V, typename I>
+basic_ic_matrix<V, I>::basic_ic_matrix() : size(0), shift(0), ptr(1, 0)
+{ }
+
+// Lower triangle of m by rows, each row ending with its diagonal - a zero
+// one if m does not store it
+template <typename V, typename I>
+basic_ic_matrix<V, I>::basic_ic_matrix(const matrix_type &m) : size(m.getHeight()), shift(0), ptr(1, 0)
+{
+	if (m.getWidth() != m.getHeight())
+		throw std::runtime_error("Factorized matrix must be square");
+
+	// Symmetric matrices store the lower triangle already
+	matrix_type row_matrix(m.toDir(row_wise));
+	if (row_matrix.getDir() != row_wise) row_matrix.toggleDir();
+	auto &m_ptr = row_matrix.getPtr();
+	auto &m_idx = row_matrix.getIdx();
+	auto &m_values = row_matrix.getValues();
+
+	ptr.reserve(size + 1);
+	idx.reserve(m_idx.size() / 2 + size);
+	values.reserve(m_idx.size() / 2 + size);
+	for (I i = 0; i < size; i++)
+	{
+		V d = 0;
+		for (sparse_offset k = m_ptr[i]; k < m_ptr[i + 1]; k++)
+		{
+			if (m_idx[k] < i)
+			{
+				idx.push_back(m_idx[k]);
+				values.push_back(m_values[k]);
+			}
+			else if (m_idx[k] == i) d = m_values[k];
+		}
+		idx.push_back(i);
+		values.push_back(d);
+		ptr.push_back(idx.size());
+	}
+}
+
+template <typename V, typename I>
+basic_ic_matrix<V, I> basic_ic_matrix<V, I>::ic0(const matrix_type &m, double shift)
+{
+	basic_ic_matrix result(m);
+	if (!result.factor(shift))
+		throw std::runtime_error("Nonpositive pivot in incomplete Cholesky factorization");
+	return result;
+}
+
+// A + alpha * diag(A) gets more diagonally dominant as alpha grows, and
+// diagonally dominant matrices with a positive diagonal do not break down.
+// Values are overwritten by a failed attempt, so every one starts from m.
+template <typename V, typename I>
+basic_ic_matrix<V, I> basic_ic_matrix<V, I>::ic0_shifted(const matrix_type &m)
+{
+	for (double shift = 0; shift <= IC_SHIFT_MAX; shift = shift == 0 ? IC_SHIFT_START : 2 * shift)
+	{
+		basic_ic_matrix result(m);
+		if (result.factor(shift)) return result;
+	}
+	throw std::runtime_error("Incomplete Cholesky factorization breaks down for every shift");
+}
+
+// METHODS
+
+// Row by row (left looking) factorization restricted to the stored pattern:
+// l_ic = (a_ic - sum of l_ij * l_cj over j < c) / l_cc for the items c of
+// row i, left to right, then l_ii = sqrt(a_ii - sum of l_ij^2). The sums run
+// over row c, with pos mapping columns of row i to their items. Returns
+// false on a pivot that is not positive.
+template <typename V, typename I>
+bool basic_ic_matrix<V, I>::factor(double shift)
+{
+	this->shift = shift;
+	arena_scope scope;
+	scratch_vector<sparse_offset> pos(size, -1, scope);
+	for (I i = 0; i < size; i++)
+	{
+		sparse_offset d = ptr[i + 1] - 1;
+		for (sparse_offset k = ptr[i]; k < d; k++)
+			pos[idx[k]] = k;
+
+		double pivot = values[d] * (1.0 + shift);
+		for (sparse_offset k = ptr[i]; k < d; k++)
+		{
+			I c = idx[k];
+			double sum = values[k];
+			for (sparse_offset t = ptr[c]; t < ptr[c + 1] - 1; t++)
+			{
+				sparse_offset p = pos[idx[t]];
+				if (p >= 0) sum -= values[p] * values[t];
+			}
+			values[k] = sum / values[ptr[c + 1] - 1];
+			pivot -= (double)values[k] * values[k];
+		}
+
+		for (sparse_offset k = ptr[i]; k < d; k++)
+			pos[idx[k]] = -1;
+
+		if (!(pivot > 0)) return false;
+		values[d] = sqrt(pivot);
+	}
+	return true;
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_ic_matrix<V, I>::getL(direction d) const
+{
+	matrix_type result(size, size, row_wise, ptr, idx, values);
+	if (d != row_wise) result.toggleDir();
+	return result;
+}
+
+// Rows of L are the columns of L^T
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_ic_matrix<V, I>::getLT(direction d) const
+{
+	matrix_type result(size, size, column_wise, ptr, idx, values);
+	if (d != column_wise) result.toggleDir();
+	return result;
+}
+
+// GETTERS
+
+template <typename V, typename I>
+I basic_ic_matrix<V, I>::getSize() const
+{ return size; }
+
+template <typename V, typename I>
+size_t basic_ic_matrix<V, I>::getNnz() const
+{ return idx.size(); }
+
+template <typename V, typename I>
+double basic_ic_matrix<V, I>::getShift() const
+{ return shift; }
+
+INSTANTIATE_SPARSE(basic_ic_matrix)
@@ -0,0 +1,61 @@
+#ifndef MPI_MATRICES_IC_MATRIX_H
+#define MPI_MATRICES_IC_MATRIX_H
+
+#include <vector>
+#include "sparse_matrix.h"
+
+// First shift of the diagonal tried after a breakdown, doubled on every
+// further one until it passes IC_SHIFT_MAX
+#define IC_SHIFT_START 1e-3
+#define IC_SHIFT_MAX 1e3
+
+// Incomplete Cholesky factor L of a symmetric positive definite matrix,
+// A ~ L * L^T, compressed by rows. Only the lower triangle of A is read and
+// only L is kept - half of the memory of ILU factors of the same pattern.
+// The diagonal is the last item of every row.
+template <typename V, typename I>
+class basic_ic_matrix
+{
+public:
+	typedef V value_type;
+	typedef I index_type;
+	typedef basic_sparse_matrix<V, I> matrix_type;
+
+// FIELDS
+private:
+	I size;
+	// alpha of the factorized A + alpha * diag(A)
+	double shift;
+	std::vector<sparse_offset> ptr;
+	std::vector<I> idx;
+	std::vector<V> values;
+
+// CONSTRUCTORS
+public:
+	basic_ic_matrix();
+
+	// IC(0) of A + shift * diag(A) - L keeps the pattern of the lower
+	// triangle of m. Throws on a pivot that is not positive.
+	static basic_ic_matrix ic0(const matrix_type &m, double shift = 0.0);
+	// IC(0) which meets a breakdown by retrying with a growing shift
+	static basic_ic_matrix ic0_shifted(const matrix_type &m);
+
+private:
+	explicit basic_ic_matrix(const matrix_type &m);
+
+// METHODS
+public:
+	matrix_type getL(direction d = column_wise) const;
+	// L^T, the upper triangular factor
+	matrix_type getLT(direction d = column_wise) const;
+	I getSize() const;
+	size_t getNnz() const;
+	double getShift() const;
+
+private:
+	bool factor(double shift);
+};
+
+typedef basic_ic_matrix<double, int> ic_matrix;
+
+#endif //MPI_MATRICES_IC_MATRIX_H
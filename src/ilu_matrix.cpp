@@ -0,0 +1,351 @@
+#include "ilu_matrix.h"
+#include "arena.h"
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <math.h>
+
+// CONSTRUCTORS
+
+template <typename V, typename I>
+basic_ilu_matrix<V, I>::basic_ilu_matrix() : size(0), ptr(1, 0)
+{ }
+
+// Pattern and values of m by rows, with a zero put on the diagonal of rows
+// that do not store one
+template <typename V, typename I>
+basic_ilu_matrix<V, I>::basic_ilu_matrix(const matrix_type &m) : size(m.getHeight()), ptr(1, 0)
+{
+	if (m.getWidth() != m.getHeight())
+		throw std::runtime_error("Factorized matrix must be square");
+
+	matrix_type row_matrix(m.isSymmetric() ? m.toGeneral() : m.toDir(row_wise));
+	if (row_matrix.getDir() != row_wise) row_matrix.toggleDir();
+	auto &m_ptr = row_matrix.getPtr();
+	auto &m_idx = row_matrix.getIdx();
+	auto &m_values = row_matrix.getValues();
+
+	ptr.reserve(size + 1);
+	diag.resize(size);
+	idx.reserve(m_idx.size() + size);
+	values.reserve(m_idx.size() + size);
+	for (I i = 0; i < size; i++)
+	{
+		bool has_diag = false;
+		for (sparse_offset k = m_ptr[i]; k < m_ptr[i + 1]; k++)
+		{
+			if (!has_diag && m_idx[k] >= i)
+			{
+				has_diag = true;
+				diag[i] = idx.size();
+				if (m_idx[k] > i)
+				{
+					idx.push_back(i);
+					values.push_back(0);
+				}
+			}
+			idx.push_back(m_idx[k]);
+			values.push_back(m_values[k]);
+		}
+		if (!has_diag)
+		{
+			diag[i] = idx.size();
+			idx.push_back(i);
+			values.push_back(0);
+		}
+		ptr.push_back(idx.size());
+	}
+}
+
+template <typename V, typename I>
+basic_ilu_matrix<V, I> basic_ilu_matrix<V, I>::ilu0(const matrix_type &m)
+{
+	basic_ilu_matrix result(m);
+	result.factor();
+	return result;
+}
+
+// Symbolic pass of ILU(k) in the order of the numeric one: row i takes fill
+// from the finished rows c it has items in, smallest c first, and an item j
+// of row c reached through item c of row i gets level
+// lev(i, c) + lev(c, j) + 1. Items of A have level 0, fill above k is never
+// stored. Values of A are put in the resulting pattern and factor() runs on
+// it as for ILU(0).
+template <typename V, typename I>
+basic_ilu_matrix<V, I> basic_ilu_matrix<V, I>::iluk(const matrix_type &m, int k)
+{
+	basic_ilu_matrix a(m);
+	if (k <= 0)
+	{
+		a.factor();
+		return a;
+	}
+
+	basic_ilu_matrix result;
+	result.size = a.size;
+	result.diag.resize(a.size);
+	result.ptr.reserve(a.size + 1);
+	// Levels of items of finished rows
+	std::vector<int> lev;
+
+	const int absent = -1;
+	arena_scope scope;
+	scratch_vector<int> row_lev(a.size, absent, scope);
+	scratch_vector<V> row_val(a.size, 0, scope);
+	scratch_vector<I> cols(scope);
+	// Columns left of the diagonal still to eliminate with, smallest first
+	std::priority_queue<I, scratch_vector<I>, std::greater<I>> lower{std::greater<I>(), scratch_vector<I>(scope)};
+
+	for (I i = 0; i < a.size; i++)
+	{
+		cols.clear();
+		for (sparse_offset t = a.ptr[i]; t < a.ptr[i + 1]; t++)
+		{
+			I j = a.idx[t];
+			row_lev[j] = 0;
+			row_val[j] = a.values[t];
+			cols.push_back(j);
+			if (j < i) lower.push(j);
+		}
+
+		while (!lower.empty())
+		{
+			I c = lower.top();
+			lower.pop();
+			for (sparse_offset t = result.diag[c] + 1; t < result.ptr[c + 1]; t++)
+			{
+				I j = result.idx[t];
+				int l = row_lev[c] + lev[t] + 1;
+				if (l > k) continue;
+				if (row_lev[j] == absent)
+				{
+					row_lev[j] = l;
+					row_val[j] = 0;
+					cols.push_back(j);
+					if (j < i) lower.push(j);
+				}
+				else if (l < row_lev[j]) row_lev[j] = l;
+			}
+		}
+
+		std::sort(cols.begin(), cols.end());
+		for (auto it = cols.begin(); it != cols.end(); it++)
+		{
+			if (*it == i) result.diag[i] = result.idx.size();
+			result.idx.push_back(*it);
+			result.values.push_back(row_val[*it]);
+			lev.push_back(row_lev[*it]);
+			row_lev[*it] = absent;
+		}
+		result.ptr.push_back(result.idx.size());
+	}
+
+	result.factor();
+	return result;
+}
+
+// Row i is built in a dense work row w from row i of A, eliminated with the
+// finished rows in increasing order as in ILU(0), except that fill anywhere
+// is accepted. Multipliers below the drop tolerance are dropped before they
+// are used; afterwards each side of the diagonal keeps at most p of its
+// largest items not below it. A pivot that comes out zero is replaced by
+// (1e-4 + tau) times the norm of the row, as in Saad's ILUT.
+template <typename V, typename I>
+basic_ilu_matrix<V, I> basic_ilu_matrix<V, I>::ilut(const matrix_type &m, int p, double tau)
+{
+	basic_ilu_matrix a(m);
+	basic_ilu_matrix result;
+	result.size = a.size;
+	result.diag.resize(a.size);
+	result.ptr.reserve(a.size + 1);
+
+	arena_scope scope;
+	scratch_vector<double> w(a.size, 0.0, scope);
+	scratch_vector<char> in_row(a.size, 0, scope);
+	scratch_vector<I> cols(scope), lower_part(scope), upper_part(scope);
+	// Columns left of the diagonal still to eliminate with, smallest first
+	std::priority_queue<I, scratch_vector<I>, std::greater<I>> lower{std::greater<I>(), scratch_vector<I>(scope)};
+
+	for (I i = 0; i < a.size; i++)
+	{
+		cols.clear();
+		double norm = 0;
+		for (sparse_offset t = a.ptr[i]; t < a.ptr[i + 1]; t++)
+		{
+			I j = a.idx[t];
+			w[j] = a.values[t];
+			in_row[j] = 1;
+			cols.push_back(j);
+			norm += w[j] * w[j];
+			if (j < i) lower.push(j);
+		}
+		norm = sqrt(norm);
+		double drop = tau * norm;
+
+		while (!lower.empty())
+		{
+			I c = lower.top();
+			lower.pop();
+			double l = w[c] / result.values[result.diag[c]];
+			w[c] = l;
+			if (fabs(l) < drop)
+			{
+				w[c] = 0;
+				continue;
+			}
+			for (sparse_offset t = result.diag[c] + 1; t < result.ptr[c + 1]; t++)
+			{
+				I j = result.idx[t];
+				if (!in_row[j])
+				{
+					in_row[j] = 1;
+					w[j] = 0;
+					cols.push_back(j);
+					if (j < i) lower.push(j);
+				}
+				w[j] -= l * result.values[t];
+			}
+		}
+
+		lower_part.clear();
+		upper_part.clear();
+		for (auto it = cols.begin(); it != cols.end(); it++)
+			if (*it != i && w[*it] != 0 && fabs(w[*it]) >= drop)
+				(*it < i ? lower_part : upper_part).push_back(*it);
+		auto larger = [&w](I x, I y) { return fabs(w[x]) > fabs(w[y]); };
+		for (auto part : {&lower_part, &upper_part})
+		{
+			if ((I)part->size() > p)
+			{
+				std::nth_element(part->begin(), part->begin() + p, part->end(), larger);
+				part->resize(p);
+			}
+			std::sort(part->begin(), part->end());
+		}
+
+		if (w[i] == 0) w[i] = norm > 0 ? (1e-4 + tau) * norm : 1.0;
+		for (auto it = lower_part.begin(); it != lower_part.end(); it++)
+		{
+			result.idx.push_back(*it);
+			result.values.push_back(w[*it]);
+		}
+		result.diag[i] = result.idx.size();
+		result.idx.push_back(i);
+		result.values.push_back(w[i]);
+		for (auto it = upper_part.begin(); it != upper_part.end(); it++)
+		{
+			result.idx.push_back(*it);
+			result.values.push_back(w[*it]);
+		}
+		result.ptr.push_back(result.idx.size());
+
+		for (auto it = cols.begin(); it != cols.end(); it++)
+		{
+			w[*it] = 0;
+			in_row[*it] = 0;
+		}
+	}
+
+	return result;
+}
+
+template <typename V, typename I>
+basic_ilu_matrix<V, I> basic_ilu_matrix<V, I>::factorize(const matrix_type &m, const ilu_options &options)
+{
+	switch (options.type)
+	{
+		case ilu_options::level_fill: return iluk(m, options.level);
+		case ilu_options::threshold: return ilut(m, options.max_fill, options.tau);
+		default: return ilu0(m);
+	}
+}
+
+// METHODS
+
+// Row by row (IKJ) elimination restricted to the stored pattern: row i is
+// reduced by the finished rows c it has items in, left to right, and items
+// of row c falling outside of row i are dropped. pos maps columns of row i
+// to their items.
+template <typename V, typename I>
+void basic_ilu_matrix<V, I>::factor()
+{
+	arena_scope scope;
+	scratch_vector<sparse_offset> pos(size, -1, scope);
+	for (I i = 0; i < size; i++)
+	{
+		for (sparse_offset k = ptr[i]; k < ptr[i + 1]; k++)
+			pos[idx[k]] = k;
+
+		for (sparse_offset k = ptr[i]; k < diag[i]; k++)
+		{
+			I c = idx[k];
+			V l = values[k] /= values[diag[c]];
+			for (sparse_offset t = diag[c] + 1; t < ptr[c + 1]; t++)
+			{
+				sparse_offset p = pos[idx[t]];
+				if (p >= 0) values[p] -= l * values[t];
+			}
+		}
+		if (values[diag[i]] == 0)
+			throw std::runtime_error("Zero pivot in incomplete factorization");
+
+		for (sparse_offset k = ptr[i]; k < ptr[i + 1]; k++)
+			pos[idx[k]] = -1;
+	}
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_ilu_matrix<V, I>::getL(direction d) const
+{
+	std::vector<sparse_offset> l_ptr(size + 1, 0);
+	std::vector<I> l_idx;
+	std::vector<V> l_values;
+	l_idx.reserve(idx.size() / 2 + size);
+	l_values.reserve(idx.size() / 2 + size);
+	for (I i = 0; i < size; i++)
+	{
+		for (sparse_offset k = ptr[i]; k < diag[i]; k++)
+		{
+			l_idx.push_back(idx[k]);
+			l_values.push_back(values[k]);
+		}
+		l_idx.push_back(i);
+		l_values.push_back(1);
+		l_ptr[i + 1] = l_idx.size();
+	}
+	matrix_type result(size, size, row_wise, std::move(l_ptr), std::move(l_idx), std::move(l_values));
+	if (d != row_wise) result.toggleDir();
+	return result;
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_ilu_matrix<V, I>::getU(direction d) const
+{
+	std::vector<sparse_offset> u_ptr(size + 1, 0);
+	std::vector<I> u_idx;
+	std::vector<V> u_values;
+	u_idx.reserve(idx.size() / 2 + size);
+	u_values.reserve(idx.size() / 2 + size);
+	for (I i = 0; i < size; i++)
+	{
+		u_idx.insert(u_idx.end(), idx.begin() + diag[i], idx.begin() + ptr[i + 1]);
+		u_values.insert(u_values.end(), values.begin() + diag[i], values.begin() + ptr[i + 1]);
+		u_ptr[i + 1] = u_idx.size();
+	}
+	matrix_type result(size, size, row_wise, std::move(u_ptr), std::move(u_idx), std::move(u_values));
+	if (d != row_wise) result.toggleDir();
+	return result;
+}
+
+// GETTERS
+
+template <typename V, typename I>
+I basic_ilu_matrix<V, I>::getSize() const
+{ return size; }
+
+template <typename V, typename I>
+size_t basic_ilu_matrix<V, I>::getNnz() const
+{ return idx.size(); }
+
+INSTANTIATE_SPARSE(basic_ilu_matrix)
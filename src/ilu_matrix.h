@@ -0,0 +1,79 @@
+#ifndef MPI_MATRICES_ILU_MATRIX_H
+#define MPI_MATRICES_ILU_MATRIX_H
+
+#include <vector>
+#include "sparse_matrix.h"
+
+// Which incomplete factorization to compute, with its parameters
+struct ilu_options
+{
+	enum kind { zero_fill, level_fill, threshold };
+
+	kind type;
+	// ILU(k) - fill with levels up to level is kept
+	int level;
+	// ILUT(p, tau) - at most max_fill items on each side of the diagonal
+	// are kept per row, none below tau times the norm of the row
+	int max_fill;
+	double tau;
+
+	static ilu_options ilu0()
+	{ return ilu_options{zero_fill, 0, 0, 0.0}; }
+
+	static ilu_options iluk(int level)
+	{ return ilu_options{level_fill, level, 0, 0.0}; }
+
+	static ilu_options ilut(int max_fill, double tau)
+	{ return ilu_options{threshold, 0, max_fill, tau}; }
+};
+
+// Incomplete LU factors of a square matrix kept together, compressed by rows:
+// L below the diagonal with its unit diagonal implied, U on and above it.
+// Every row stores its diagonal, which diag points at. Factorization only
+// ever touches stored items, so nothing is densified.
+template <typename V, typename I>
+class basic_ilu_matrix
+{
+public:
+	typedef V value_type;
+	typedef I index_type;
+	typedef basic_sparse_matrix<V, I> matrix_type;
+
+// FIELDS
+private:
+	I size;
+	std::vector<sparse_offset> ptr;
+	std::vector<I> idx;
+	std::vector<sparse_offset> diag;
+	std::vector<V> values;
+
+// CONSTRUCTORS
+public:
+	basic_ilu_matrix();
+
+	// ILU(0) - factors keep the sparsity pattern of m
+	static basic_ilu_matrix ilu0(const matrix_type &m);
+	// ILU(k) - factors keep fill of levels up to k
+	static basic_ilu_matrix iluk(const matrix_type &m, int k);
+	// ILUT(p, tau) - fill is kept by size
+	static basic_ilu_matrix ilut(const matrix_type &m, int p, double tau);
+	static basic_ilu_matrix factorize(const matrix_type &m, const ilu_options &options);
+
+private:
+	explicit basic_ilu_matrix(const matrix_type &m);
+
+// METHODS
+public:
+	// L with its unit diagonal
+	matrix_type getL(direction d = column_wise) const;
+	matrix_type getU(direction d = column_wise) const;
+	I getSize() const;
+	size_t getNnz() const;
+
+private:
+	void factor();
+};
+
+typedef basic_ilu_matrix<double, int> ilu_matrix;
+
+#endif //MPI_MATRICES_ILU_MATRIX_H
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <mpi.h>
 #include <sstream>
+#include <cstdlib>
 #include <vector>
 #include "sparse_matrix.h"
 #include "mpimatrix.h"
@@ -49,13 +50,15 @@ void genRandomM(int rank, int size)
 
 int main (int argc, char *argv[])
 {
-    int rank, size;
+    int rank, size, provided;
     std::clock_t start;
-    MPI_Init(&argc,&argv);
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD,&rank);
     MPI_Comm_size(MPI_COMM_WORLD,&size);
 
-    MpiMatrixHelper mpi_helper(rank, size);
+    // Hybrid mode - every rank runs OMP_NUM_THREADS threads in its kernels
+    const char *omp_threads = getenv("OMP_NUM_THREADS");
+    MpiMatrixHelper mpi_helper(rank, size, omp_threads ? atoi(omp_threads) : 1);
 
     auto m1 = mpi_helper.load("big", sparse, column_wise, 1);
     auto m2 = mpi_helper.load("big", sparse, row_wise, 1);
@@ -96,7 +99,7 @@ int main (int argc, char *argv[])
     for(int i=0; i<n; i++)
         b[i] = i;
     start = std::clock();
-    auto cg_result = mpi_helper.CG_ILU_PRECONDITIONED_WITH_ILU(m1, b);
+    auto cg_result = mpi_helper.CG_ILU_PRECONDITIONED(m1, b);
     auto time = ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
     printf("TIME = %f\n", time);
 
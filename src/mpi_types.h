@@ -0,0 +1,72 @@
+#ifndef MPI_MATRICES_MPI_TYPES_H
+#define MPI_MATRICES_MPI_TYPES_H
+
+#include <mpi.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include "sparse_matrix_elem.h"
+
+// MPI datatype matching C++ type T, chosen at compile time
+template <typename T> struct mpi_type;
+
+template <> struct mpi_type<int32_t>
+{ static MPI_Datatype get() { return MPI_INT32_T; } };
+
+template <> struct mpi_type<int64_t>
+{ static MPI_Datatype get() { return MPI_INT64_T; } };
+
+template <> struct mpi_type<float>
+{ static MPI_Datatype get() { return MPI_FLOAT; } };
+
+template <> struct mpi_type<double>
+{ static MPI_Datatype get() { return MPI_DOUBLE; } };
+
+// Committed struct datatype laid out like basic_sparse_matrix_elem<V, I>
+template <typename V, typename I>
+MPI_Datatype create_sparse_elem_type()
+{
+	typedef basic_sparse_matrix_elem<V, I> elem;
+	int blocklengths[2] = {2, 1};
+	MPI_Datatype types[2] = {mpi_type<I>::get(), mpi_type<V>::get()};
+	MPI_Aint offsets[2] = {offsetof(elem, col), offsetof(elem, value)};
+
+	MPI_Datatype tmp, result;
+	MPI_Type_create_struct(2, blocklengths, offsets, types, &tmp);
+	// Padding at the end belongs to the element too
+	MPI_Type_create_resized(tmp, 0, sizeof(elem), &result);
+	MPI_Type_free(&tmp);
+	MPI_Type_commit(&result);
+	return result;
+}
+
+// Most elements passed to a single MPI call - counts are int in MPI, so
+// longer arrays go in several messages
+#define MPI_MAX_COUNT (1 << 30)
+
+// Most elements send_array and recv_array pass at once - MPI_MAX_COUNT
+// unless lowered, on every rank alike, to have short arrays split as well
+inline size_t &mpi_max_count()
+{
+	static size_t max_count = MPI_MAX_COUNT;
+	return max_count;
+}
+
+template <typename T>
+void send_array(const T *data, size_t count, int node, MPI_Datatype type = mpi_type<T>::get())
+{
+	size_t max_count = mpi_max_count();
+	for (size_t sent = 0; sent < count; sent += max_count)
+		MPI_Send(data + sent, (int)std::min(count - sent, max_count), type, node, 0, MPI_COMM_WORLD);
+}
+
+template <typename T>
+void recv_array(T *data, size_t count, int node, MPI_Datatype type = mpi_type<T>::get())
+{
+	size_t max_count = mpi_max_count();
+	for (size_t received = 0; received < count; received += max_count)
+		MPI_Recv(data + received, (int)std::min(count - received, max_count), type, node, 0,
+				 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+}
+
+#endif //MPI_MATRICES_MPI_TYPES_H
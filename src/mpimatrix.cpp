@@ -5,21 +5,25 @@
 #include <vector>
 #include <array>
 #include <algorithm>
+#include <utility>
 #include "mpimatrix.h"
+#include "mpi_types.h"
+#include "arena.h"
 
 using namespace std;
 
-MpiMatrixHelper::MpiMatrixHelper()
+MpiMatrixHelper::MpiMatrixHelper() : threads(1)
 { init(); }
 
-MpiMatrixHelper::MpiMatrixHelper(int rank, int proc_cnt)
-        : rank(rank), processors_cnt(proc_cnt)
+MpiMatrixHelper::MpiMatrixHelper(int rank, int proc_cnt, int threads)
+        : rank(rank), processors_cnt(proc_cnt), threads(threads)
 { init(); }
 
 MpiMatrixHelper::MpiMatrixHelper(const MpiMatrixHelper &m)
 {
     rank = m.rank;
     processors_cnt = m.processors_cnt;
+    threads = m.threads;
     sparse_elem_type = m.sparse_elem_type;
 }
 
@@ -28,84 +32,155 @@ MpiMatrixHelper::~MpiMatrixHelper()
 
 void MpiMatrixHelper::createSparseElemDatatype()
 {
-    const int nitems = 2;
-    int blocklengths[2] = {2, 1};
-    MPI_Datatype types[2] = {MPI_INT, MPI_DOUBLE};
-    MPI_Aint offsets[2];
-    MPI_Aint extent;
-    MPI_Type_extent(MPI_INT, &extent);
-    offsets[0] = 0;
-    offsets[1] = 2 * extent;
-
-    MPI_Type_create_struct(nitems, blocklengths, offsets, types, &sparse_elem_type);
-    MPI_Type_commit(&sparse_elem_type);
+    sparse_elem_type = create_sparse_elem_type<sparse_matrix::value_type, sparse_matrix::index_type>();
 }
 
 void MpiMatrixHelper::init()
 {
     createSparseElemDatatype();
+
+    // Threads other than the master must not be around unless MPI was
+    // initialized with at least MPI_THREAD_FUNNELED
+    int provided = MPI_THREAD_SINGLE;
+    MPI_Query_thread(&provided);
+    if (threads < 1 || provided < MPI_THREAD_FUNNELED)
+        threads = 1;
 }
 
-sparse_matrix MpiMatrixHelper::load(const char *path, MatrixType type, direction dir, int offset)
+sparse_matrix MpiMatrixHelper::load(const char *path, MatrixType type, direction dir, int offset, bool symmetric)
 {
     if (rank != 0) return sparse_matrix();
-    if (type == sparse) return sparse_matrix::fromSparseFile(path, dir, offset);
+    if (type == sparse) return sparse_matrix::fromSparseFile(path, dir, offset, symmetric);
     else if (type == dense) return sparse_matrix::fromDenseFile(path, dir);
     else throw std::runtime_error("wrong data matrix file type");
 }
 
-void MpiMatrixHelper::sendVector(int node, sparse_vector vector)
+// Stored indices and values go as they are, with no coordinate staging
+void MpiMatrixHelper::sendVector(int node, const sparse_vector &vector)
 {
     direction dir = vector.getDir();
-    auto raw_data = vector.getElements(dir);
-    int elem_cnt = raw_data.size();
+    int64_t elem_cnt = vector.getNnz();
     int size = vector.size();
 
-    MPI_Send(&elem_cnt, 1, MPI_INT, node, 0, MPI_COMM_WORLD);
+    MPI_Send(&elem_cnt, 1, MPI_INT64_T, node, 0, MPI_COMM_WORLD);
     MPI_Send(&size, 1, MPI_INT, node, 0, MPI_COMM_WORLD);
     MPI_Send(&dir, 1, MPI_INT, node, 0, MPI_COMM_WORLD);
-    MPI_Send(&raw_data.front(), elem_cnt, sparse_elem_type, node, 0, MPI_COMM_WORLD);
+    send_array(vector.getIndices().data(), elem_cnt, node);
+    send_array(vector.getValues().data(), elem_cnt, node);
 }
 
 sparse_vector MpiMatrixHelper::receiveVector(int node)
 {
-    int size, elem_cnt;
+    int size;
+    int64_t elem_cnt;
     direction dir;
-    MPI_Recv(&elem_cnt, 1, MPI_INT, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Status status;
+    MPI_Recv(&elem_cnt, 1, MPI_INT64_T, node, 0, MPI_COMM_WORLD, &status);
+    // The rest comes from the same sender even if any one was accepted
+    node = status.MPI_SOURCE;
     MPI_Recv(&size, 1, MPI_INT, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
     MPI_Recv(&dir, 1, MPI_INT, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
-    vector<sparse_matrix_elem> data(elem_cnt);
-    MPI_Recv(&data[0], elem_cnt, sparse_elem_type, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    vector<sparse_vector::index_type> indices(elem_cnt);
+    vector<sparse_vector::value_type> values(elem_cnt);
+    recv_array(indices.data(), elem_cnt, node);
+    recv_array(values.data(), elem_cnt, node);
 
-    return sparse_vector(size, dir, data);
+    return sparse_vector(size, dir, std::move(indices), std::move(values));
 }
 
-void MpiMatrixHelper::sendMatrix(int node, sparse_matrix matrix)
+void MpiMatrixHelper::sendVector(int node, const dense_vector &vector)
 {
-    auto raw_data = matrix.getRawData();
-    int size = static_cast<int>(raw_data.size());
-    int width = matrix.getWidth();
-    int height = matrix.getHeight();
-
+    int size = vector.size();
     MPI_Send(&size, 1, MPI_INT, node, 0, MPI_COMM_WORLD);
-    MPI_Send(&raw_data.front(), size, sparse_elem_type, node, 0, MPI_COMM_WORLD);
+    send_array(vector.getData(), size, node);
+}
 
-    MPI_Send(&width, 1, MPI_INT, node, 0, MPI_COMM_WORLD);
-    MPI_Send(&height, 1, MPI_INT, node, 0, MPI_COMM_WORLD);
+dense_vector MpiMatrixHelper::receiveDenseVector(int node)
+{
+    int size;
+    MPI_Recv(&size, 1, MPI_INT, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    dense_vector result(size, column_wise);
+    recv_array(result.getData(), size, node);
+    return result;
 }
 
-sparse_matrix MpiMatrixHelper::receiveMatrix(int node, direction dir)
+// Adds the vector sent by node to the given one, receiving it into scratch
+// memory of the calling thread instead of a vector of its own
+void MpiMatrixHelper::receiveDenseVectorAdd(int node, dense_vector &to)
 {
     int size;
     MPI_Recv(&size, 1, MPI_INT, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    if (size != to.size())
+        throw std::runtime_error("Dimensions of vectors do not match");
+
+    arena_scope scope;
+    scratch_vector<double> part(size, 0.0, scope);
+    recv_array(part.data(), size, node);
+    double *data = to.getData();
+    for (int i = 0; i < size; i++)
+        data[i] += part[i];
+}
 
-    vector<sparse_matrix_elem> data(size);
-    MPI_Recv(&data[0], size, sparse_elem_type, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+void MpiMatrixHelper::sendMatrix(int node, const sparse_matrix &matrix)
+{
+    int vectors = matrix.getDir() == column_wise ? matrix.getWidth() : matrix.getHeight();
+    sendMatrix(node, matrix, 0, vectors);
+}
+
+// The part goes straight from arrays of the whole matrix - only its offsets,
+// shifted to start at zero, are built in scratch memory
+void MpiMatrixHelper::sendMatrix(int node, const sparse_matrix &matrix, int begin, int end)
+{
+    int width = matrix.getWidth();
+    int height = matrix.getHeight();
+    int dir = matrix.getDir();
+    int symmetric = matrix.isSymmetric();
+    auto &ptr = matrix.getPtr();
+    auto &idx = matrix.getIdx();
+    auto &values = matrix.getValues();
+    int64_t size = ptr[end] - ptr[begin];
+
+    MPI_Send(&width, 1, MPI_INT, node, 0, MPI_COMM_WORLD);
+    MPI_Send(&height, 1, MPI_INT, node, 0, MPI_COMM_WORLD);
+    MPI_Send(&dir, 1, MPI_INT, node, 0, MPI_COMM_WORLD);
+    MPI_Send(&size, 1, MPI_INT64_T, node, 0, MPI_COMM_WORLD);
+    MPI_Send(&symmetric, 1, MPI_INT, node, 0, MPI_COMM_WORLD);
+
+    // Compressed arrays go as they are - no COO staging - in pieces small
+    // enough for int counts of MPI
+    if (begin == 0 && end == (int)ptr.size() - 1)
+        send_array(ptr.data(), ptr.size(), node);
+    else
+    {
+        arena_scope scope;
+        scratch_vector<sparse_offset> part_ptr(ptr.size(), 0, scope);
+        for (size_t i = begin; i + 1 < ptr.size(); i++)
+            part_ptr[i + 1] = ptr[(int)i < end ? i + 1 : end] - ptr[begin];
+        send_array(part_ptr.data(), part_ptr.size(), node);
+    }
+    send_array(idx.data() + ptr[begin], size, node);
+    send_array(values.data() + ptr[begin], size, node);
+}
 
-    int width, height;
+sparse_matrix MpiMatrixHelper::receiveMatrix(int node, direction dir)
+{
+    int width, height, sent_dir, symmetric;
+    int64_t size;
     MPI_Recv(&width, 1, MPI_INT, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
     MPI_Recv(&height, 1, MPI_INT, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-    return sparse_matrix(data, width, height, dir);
+    MPI_Recv(&sent_dir, 1, MPI_INT, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Recv(&size, 1, MPI_INT64_T, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Recv(&symmetric, 1, MPI_INT, node, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+    vector<sparse_offset> ptr((sent_dir == column_wise ? width : height) + 1);
+    vector<sparse_matrix::index_type> idx(size);
+    vector<sparse_matrix::value_type> values(size);
+    recv_array(ptr.data(), ptr.size(), node);
+    recv_array(idx.data(), size, node);
+    recv_array(values.data(), size, node);
+
+    sparse_matrix result(width, height, (direction)sent_dir, std::move(ptr), std::move(idx), std::move(values), symmetric);
+    if (result.getDir() != dir) result.toggleDir(threads);
+    return result;
 }
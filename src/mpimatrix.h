@@ -2,7 +2,10 @@
 #define MPI_MATRIX_H
 
 #include <mpi.h>
+#include <functional>
 #include "sparse_matrix.h"
+#include "ilu_matrix.h"
+#include "ic_matrix.h"
 
 enum MatrixType { sparse, dense, MatrixType_count };
 
@@ -11,47 +14,79 @@ class MpiMatrixHelper
 public:
 	int rank;
 	int processors_cnt;
+	// OpenMP threads used by kernels inside each rank - hybrid runs start one
+	// rank per socket with MPI_THREAD_FUNNELED, all MPI calls stay on the master
+	int threads;
 	MPI_Datatype sparse_elem_type;
 
 public:
 	MpiMatrixHelper();
-	MpiMatrixHelper(int rank, int proc_cnt);
+	MpiMatrixHelper(int rank, int proc_cnt, int threads = 1);
 	MpiMatrixHelper(const MpiMatrixHelper &m);
 	~MpiMatrixHelper();
 
 public:
-	sparse_matrix load(const char* path, MatrixType type, direction dir = column_wise, int offset = 0);
+	sparse_matrix load(const char* path, MatrixType type, direction dir = column_wise, int offset = 0,
+					   bool symmetric = false);
 
 	sparse_matrix add(const sparse_matrix &a, const sparse_matrix &b);
 	sparse_matrix sub(const sparse_matrix &a, const sparse_matrix &b);
 	sparse_matrix mul(const sparse_matrix &a, const sparse_matrix &b);
+	sparse_matrix mul(const sparse_matrix &a, const transposed_matrix &b);
 
 	void addto(sparse_matrix &to, const sparse_matrix &what);
 	void subto(sparse_matrix &to, const sparse_matrix &what);
 
 	sparse_vector mul(const sparse_matrix &A, const sparse_vector &x);
+	dense_vector mul(const sparse_matrix &A, const dense_vector &x);
+	sparse_vector mul(const transposed_matrix &A, const sparse_vector &x);
+	dense_vector mul(const transposed_matrix &A, const dense_vector &x);
 
 	void LU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix &U);
-	void ILU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix &U);
+	// Incomplete factorization computed by rank 0, ILU(0) by default
+	void ILU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix &U,
+			 const ilu_options &options = ilu_options::ilu0());
+	// Incomplete factorization of the diagonal blocks of A, one block of rows
+	// per worker
+	void BlockILU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix &U,
+				  const ilu_options &options = ilu_options::ilu0());
+
+	// Incomplete Cholesky factor of SPD A computed by rank 0, A ~ L * L^T.
+	// With shift a breakdown is met by factorizing A + alpha * diag(A).
+	void IC(const sparse_matrix &A, sparse_matrix &L, bool shift = true);
 
 	sparse_vector solveTrian(const sparse_matrix &A, const sparse_vector &b);
 	sparse_matrix SolveManyTrian(const sparse_matrix &A, const sparse_matrix &B);
 	sparse_matrix Inverse(const sparse_matrix &A);
 	sparse_vector CG(const sparse_matrix &A, const sparse_vector &b);
-	sparse_vector CG_ILU(const sparse_matrix &A, const sparse_vector &b);
+	// With multicolor the factors are computed for A reordered by colors
+	sparse_vector CG_ILU(const sparse_matrix &A, const sparse_vector &b,
+						 const ilu_options &options = ilu_options::ilu0(), bool multicolor = false);
+	// CG preconditioned with incomplete Cholesky - SPD A needs L only
+	sparse_vector CG_IC(const sparse_matrix &A, const sparse_vector &b, bool shift = true,
+						bool multicolor = false);
+	// CG in double preconditioned with ILU factors stored in single precision
+	sparse_vector CG_ILU_MIXED(const sparse_matrix &A, const sparse_vector &b);
+	// CG split preconditioned with M = L * L^T for a lower triangular L,
+	// applied by triangular solves
+	sparse_vector CG_SPLIT(const sparse_matrix &A, const sparse_vector &b, const sparse_matrix &L);
 	sparse_vector CG_ILU_PRECONDITIONED(const sparse_matrix &A, const sparse_vector &b);
-	sparse_vector CG_ILU_PRECONDITIONED_COPY(const sparse_matrix &A, const sparse_vector &b);
-	sparse_vector PRECONDITIONED_2(const sparse_matrix &A, const sparse_vector &b, const sparse_matrix &M_inv);
-	sparse_vector CG_ILU_PRECONDITIONED_2(const sparse_matrix &A, const sparse_vector &b);
-	sparse_vector CG_ILU_PRECONDITIONED_WITH_ILU(const sparse_matrix &A, const sparse_vector &b);
 
 private:
 	void init();
 	void createSparseElemDatatype();
-	void sendMatrix(int node, sparse_matrix matrix);
+	void sendMatrix(int node, const sparse_matrix &matrix);
+	// Sends vectors [begin, end) of matrix as the part splitToN would cut
+	void sendMatrix(int node, const sparse_matrix &matrix, int begin, int end);
 	sparse_matrix receiveMatrix(int node, direction dir);
-	void sendVector(int node, sparse_vector vector);
+	void sendVector(int node, const sparse_vector &vector);
 	sparse_vector receiveVector(int node);
+	void sendVector(int node, const dense_vector &vector);
+	dense_vector receiveDenseVector(int node);
+	void receiveDenseVectorAdd(int node, dense_vector &to);
+	sparse_vector PCG(const sparse_matrix &A, const sparse_vector &b,
+					  const std::function<dense_vector(const dense_vector &)> &precondition,
+					  bool flexible = false);
 };
 
 #endif
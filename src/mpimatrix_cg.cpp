@@ -3,54 +3,28 @@
 //
 
 #include "mpimatrix.h"
+#include "trian_matrix.h"
+#include <math.h>
 
 #define CG_EPS 1e-6
 #define CG_MAX_ITERS 500
 
-sparse_vector solveILU(const sparse_matrix &L, const sparse_matrix &U, const sparse_vector &b)
-{
-    int n = b.size();
-    double *tmp = new double[n];
-    sparse_vector x(n);
-
-    // Solve L
-    for (int r = 0; r < n; ++r)
-    {
-        auto sum = 0.0f;
-        for (int c = 0; c < r; ++c)
-            sum += L[c][r] * tmp[c];
-        tmp[r] = (b[r] - sum) / L[r][r];
-    }
-
-    // Solve U
-    for (int r = n - 1; r >= 0; --r)
-    {
-        auto sum = 0.0f;
-        for (int c = r + 1; c < n; ++c)
-            sum += U[c][r] * x[c];
-        x[r] = (tmp[r] - sum) / U[r][r];
-    }
-
-    delete[] tmp;
-    return x;
-}
-
 sparse_vector MpiMatrixHelper::CG(const sparse_matrix &A, const sparse_vector &b)
 {
-    sparse_vector x(b.size(), column_wise);
+    dense_vector x(b.size(), column_wise);
 
     // CONJUGATE GRADIENT
     double alpha, beta, rho0, rho1, norm_b, residual;
-    sparse_vector p, q, r;
+    dense_vector p, q, r;
     int iteration;
 
     if (rank == 0)
     {
-        norm_b = b.l2_norm();
-        r = p = b;
+        r = p = dense_vector(b);
+        norm_b = r.l2_norm(threads);
         if (norm_b == 0.0) norm_b = 1.0;
-        residual = r.l2_norm() / norm_b;
-        rho1 = r.dot(r);
+        rho0 = r.dot(r, threads);
+        residual = sqrt(rho0) / norm_b;
     }
 
     for(iteration = 1; iteration <= CG_MAX_ITERS; iteration++)
@@ -61,228 +35,254 @@ sparse_vector MpiMatrixHelper::CG(const sparse_matrix &A, const sparse_vector &b
         q = mul(A, p);
         if(rank == 0)
         {
-            rho0 = r.dot(r);
-            alpha = rho0 / p.dot(q);
-            x += p * alpha;
-            r -= q * alpha;
-            beta = rho0 / rho1;
-            p = r + p * beta;
-            residual = r.l2_norm() / norm_b;
-            rho1 = rho0;
+            alpha = rho0 / p.dot(q, threads);
+            x.axpy(alpha, p, threads);
+            r.axpy(-alpha, q, threads);
+            rho1 = r.dot(r, threads);
+            beta = rho1 / rho0;
+            p.axpby(1.0, r, beta, threads);
+            residual = sqrt(rho1) / norm_b;
+            rho0 = rho1;
         }
 
         //printf("Residual: %f\n", residual);
     }
 
     if(rank == 0) printf("ITER CNT = %d\n", iteration-1);
-    return x;
+    return x.toSparse();
 }
 
-sparse_vector MpiMatrixHelper:: PRECONDITIONED_2(const sparse_matrix &A, const sparse_vector &b, const sparse_matrix &M_inv)
+// Preconditioned CG, rank 0 applies the preconditioner to the residual.
+// A flexible preconditioner - one that varies slightly between iterations,
+// as factors applied in single precision do - makes beta take the flexible
+// (Polak-Ribiere) form z_k+1 . (r_k+1 - r_k) / (z_k . r_k), and once the
+// recurred residual reaches CG_EPS it is replaced by the true b - A * x and
+// iterations restart from there unless that one is small enough too.
+sparse_vector MpiMatrixHelper::PCG(const sparse_matrix &A, const sparse_vector &b,
+                                   const std::function<dense_vector(const dense_vector &)> &precondition,
+                                   bool flexible)
 {
-    sparse_vector x(b.size(), column_wise);
-    for(int i=0; i<b.size(); i++)
-        x[i] = 1;
-
+    dense_vector x(b.size(), column_wise);
     double alpha, beta, rho0, rho1, norm_b, residual;
-    sparse_vector p, z, q, r;
+    dense_vector p, z, q, r;
     int iteration;
+    bool restart = true;
 
     if (rank == 0)
     {
-        norm_b = b.l2_norm();
-        r = b - mul(A, x); // but x is zero vector in this case
+        r = dense_vector(b); // - mul(A, x); // but x is zero vector in this case
+        norm_b = r.l2_norm(threads);
         if (norm_b == 0.0) norm_b = 1.0;
-        residual = r.l2_norm() / norm_b;
+        residual = r.l2_norm(threads) / norm_b;
     }
 
-    p = mul(M_inv, r);
-    z = p; // z0
-
     for(iteration = 1; iteration <= CG_MAX_ITERS; iteration++)
     {
-        q = mul(A, p);
-        if(rank == 0)
+        MPI_Bcast(&residual, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        if(residual <= CG_EPS)
+        {
+            if (!flexible) break;
+            auto Ax = mul(A, x);
+            if (rank == 0)
+            {
+                r = dense_vector(b) - Ax;
+                residual = r.l2_norm(threads) / norm_b;
+                restart = true;
+            }
+            MPI_Bcast(&residual, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+            if(residual <= CG_EPS) break;
+        }
+
+        if(rank == 0 && restart)
         {
-            rho0 = r.dot(z);
-            alpha = rho0 / p.dot(q);
-            x += p * alpha;
-            r -= q * alpha;
-            residual = r.l2_norm() / norm_b;
+            z = precondition(r);
+            p = z;
+            rho0 = r.dot(z, threads);
+            restart = false;
         }
-        z = mul(M_inv, r);
+
+        q = mul(A, p);
+
         if(rank == 0)
         {
-            rho1 = r.dot(z);
-            beta = rho1 / rho0;
-            p = z + p * beta;
+            alpha = rho0 / p.dot(q, threads);
+            x.axpy(alpha, p, threads);
+            r.axpy(-alpha, q, threads);
+            residual = r.l2_norm(threads) / norm_b;
+
+            z = precondition(r);
+            rho1 = r.dot(z, threads);
+            // r_k+1 - r_k = -alpha * q
+            beta = flexible ? -alpha * z.dot(q, threads) / rho0 : rho1 / rho0;
+            p.axpby(1.0, z, beta, threads);
+            rho0 = rho1;
         }
-        MPI_Bcast(&residual, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-        if(residual <= CG_EPS) break;
-        printf("Residual: %f\n", residual);
     }
 
     if(rank == 0)
-        printf("ITER CNT = %d\n", iteration);
+        printf("ITER CNT = %d\n", iteration - 1);
 
-    return x;
+    return x.toSparse();
 }
 
-sparse_vector MpiMatrixHelper::CG_ILU(const sparse_matrix &A, const sparse_vector &b)
+// Preconditioner solving with factors of P * A * P^T for a reordering P
+// given by order - the residual goes to the factors' order and the result
+// back to the order of A
+static dense_vector reorderedSolve(const std::vector<int> &order, const dense_vector &r,
+                                   const trian_matrix &L, const trian_matrix &U, int threads)
 {
-    sparse_vector x(b.size(), column_wise);
-    sparse_matrix L, U;
-    ILU(A, L, U);
-
-    double alpha, beta, rho0, rho1, norm_b, residual;
-    sparse_vector p, z, q, r;
-    int iteration;
+    int n = r.size();
+    dense_vector r_p(n, r.getDir()), z(n, r.getDir());
+    for (int k = 0; k < n; k++)
+        r_p[k] = r[order[k]];
+    L.solve(r_p.getData(), r_p.getData(), threads);
+    U.solve(r_p.getData(), r_p.getData(), threads);
+    for (int k = 0; k < n; k++)
+        z[order[k]] = r_p[k];
+    return z;
+}
 
-    if (rank == 0)
+// Stronger factorizations - ILU(k) or ILUT - take longer to compute but cut
+// the number of iterations. Multicolor ordering gives factors of few wide
+// levels, solved by threads, at the cost of a weaker preconditioner.
+sparse_vector MpiMatrixHelper::CG_ILU(const sparse_matrix &A, const sparse_vector &b, const ilu_options &options,
+                                      bool multicolor)
+{
+    std::vector<int> order;
+    sparse_matrix L, U;
+    if (multicolor && rank == 0)
     {
-        norm_b = b.l2_norm();
-        r = b; // - mul(A, x); // but x is zero vector in this case
-        if (norm_b == 0.0) norm_b = 1.0;
-        residual = r.l2_norm() / norm_b;
+        order = A.multicolorOrder();
+        ILU(A.permuted(order), L, U, options);
     }
+    else ILU(A, L, U, options);
 
-    for(iteration = 1; iteration <= CG_MAX_ITERS; iteration++)
+    // Levels of the factors are found once for all iterations
+    trian_matrix L_trian, U_trian;
+    if (rank == 0)
     {
-        if(rank == 0)
-        {
-            z = solveILU(L, U, r);
-            rho0 = r.dot(z);
-
-            if (iteration == 1) p = z;
-            else
-            {
-                beta = rho0 / rho1;
-                p = z + p * beta;
-            }
-        }
-
-        q = mul(A, p);
-
-        if(rank == 0)
-        {
-            alpha = rho0 / p.dot(q);
-            x += p * alpha;
-            r -= q * alpha;
-            rho1 = rho0;
-            residual = r.l2_norm() / norm_b;
-        }
-        MPI_Bcast(&residual, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-        if(residual <= CG_EPS) break;
-        printf("IT: %d, Residual = %f\n", iteration, residual);
+        L_trian = trian_matrix(L, lower_triangle, true);
+        U_trian = trian_matrix(U, upper_triangle);
     }
 
-    if(rank == 0)
-        printf("ITER CNT = %d\n", iteration);
-
-    return x;
+    if (multicolor)
+        return PCG(A, b, [&](const dense_vector &r) {
+            return reorderedSolve(order, r, L_trian, U_trian, threads);
+        });
+    return PCG(A, b, [&](const dense_vector &r) {
+        return U_trian.solve(L_trian.solve(r, threads), threads);
+    });
 }
 
-sparse_vector MpiMatrixHelper::CG_ILU_PRECONDITIONED(const sparse_matrix &A, const sparse_vector &b)
+// M = L * L^T is applied as a solve with L followed by one with L^T, both
+// made from the single factor
+sparse_vector MpiMatrixHelper::CG_IC(const sparse_matrix &A, const sparse_vector &b, bool shift, bool multicolor)
 {
-    sparse_matrix L, U;
-    ILU(A, L, U);
-    auto L_inv = Inverse(L);
-    auto L_inv_T(L_inv);
-    if(rank == 0) L_inv_T.transpose();
-    auto left = mul(L_inv, A);
-    auto A_prec = mul(left, L_inv_T);
-    auto b_prec = mul(L_inv, b);
-
-    A_prec.clean();
-    b_prec.clean();
-
-    auto x = CG(A_prec, b_prec);
-    return mul(L_inv_T, x);
-}
+    std::vector<int> order;
+    trian_matrix L_trian, LT_trian;
+    if (rank == 0)
+    {
+        if (multicolor) order = A.multicolorOrder();
+        auto factor = multicolor ?
+                      (shift ? ic_matrix::ic0_shifted(A.permuted(order)) : ic_matrix::ic0(A.permuted(order))) :
+                      (shift ? ic_matrix::ic0_shifted(A) : ic_matrix::ic0(A));
+        L_trian = trian_matrix(factor.getL(row_wise), lower_triangle);
+        LT_trian = trian_matrix(factor.getLT(row_wise), upper_triangle);
+    }
 
-sparse_vector MpiMatrixHelper::CG_ILU_PRECONDITIONED_WITH_ILU(const sparse_matrix &A, const sparse_vector &b){
-    sparse_matrix L, U;
-    ILU(A, L, U);
-    auto L_inv = Inverse(L);
-    auto L_inv_T(L_inv);
-    if(rank == 0) L_inv_T.transpose();
-    auto left = mul(L_inv, A);
-    auto A_prec = mul(left, L_inv_T);
-    auto b_prec = mul(L_inv, b);
-
-    A_prec.clean();
-    b_prec.clean();
-
-    auto x = CG_ILU(A_prec, b_prec);
-    return mul(L_inv_T, x);
+    if (multicolor)
+        return PCG(A, b, [&](const dense_vector &r) {
+            return reorderedSolve(order, r, L_trian, LT_trian, threads);
+        });
+    return PCG(A, b, [&](const dense_vector &r) {
+        return LT_trian.solve(L_trian.solve(r, threads), threads);
+    });
 }
 
-sparse_vector MpiMatrixHelper::CG_ILU_PRECONDITIONED_COPY(const sparse_matrix &A, const sparse_vector &b)
+// Factors of the mixed precision solver
+typedef basic_trian_matrix<float, int> float_trian;
+
+// CG whose vectors and residuals stay in double while the ILU factors are
+// applied in single precision. Rounding makes the float preconditioner vary
+// slightly between iterations, so it runs as a flexible one.
+sparse_vector MpiMatrixHelper::CG_ILU_MIXED(const sparse_matrix &A, const sparse_vector &b)
 {
     sparse_matrix L, U;
     ILU(A, L, U);
-    auto L_inv = Inverse(L);
-    auto L_inv_T(L_inv);
-    if(rank == 0) L_inv_T.transpose();
-    auto A_prec = mul(mul(L_inv, A), L_inv_T);
-    auto b_prec = mul(L_inv, b);
-    auto x = CG(A_prec, b_prec);
-    return mul(L_inv_T, x);
+
+    float_trian L_f, U_f;
+    if (rank == 0)
+    {
+        L_f = float_trian(L.convert<float, int>(), lower_triangle, true);
+        U_f = float_trian(U.convert<float, int>(), upper_triangle);
+    }
+
+    return PCG(A, b, [&](const dense_vector &r) {
+        return U_f.solve(L_f.solve(r, threads), threads);
+    }, true);
 }
 
-sparse_vector MpiMatrixHelper::CG_ILU_PRECONDITIONED_2(const sparse_matrix &A, const sparse_vector &b)
+// CG on L^-1 * A * L^-T y = L^-1 * b with x = L^-T y, for M = L * L^T.
+// Neither the inverse of L nor the preconditioned matrix is formed - every
+// iteration takes a solve with L^T before the product with A and a solve
+// with L after it, and x is gathered from the same L^-T p as y would be.
+// The residual checked is the one of the preconditioned system.
+sparse_vector MpiMatrixHelper::CG_SPLIT(const sparse_matrix &A, const sparse_vector &b, const sparse_matrix &L)
 {
-    sparse_matrix L, U;
-    ILU(A, L, U);
-
-    auto L_T(L);
-    L_T.transpose();
-    auto M = mul(L, L_T);
-    auto M_inv = Inverse(M);
+    dense_vector x(b.size(), column_wise);
 
-    sparse_vector x(b.size(), column_wise);
-    for(int i=0; i<b.size(); i++)
-        x[i] = 1;
+    trian_matrix L_trian, LT_trian;
+    if (rank == 0)
+    {
+        sparse_matrix LT(L);
+        LT.transpose(threads);
+        L_trian = trian_matrix(L, lower_triangle);
+        LT_trian = trian_matrix(LT, upper_triangle);
+    }
 
     double alpha, beta, rho0, rho1, norm_b, residual;
-    sparse_vector p, z, q, r;
+    dense_vector p, w, q, r;
     int iteration;
 
     if (rank == 0)
     {
-        norm_b = b.l2_norm();
-        r = b - mul(A, x); // but x is zero vector in this case
+        r = L_trian.solve(dense_vector(b), threads);
+        p = r;
+        norm_b = r.l2_norm(threads);
         if (norm_b == 0.0) norm_b = 1.0;
-        residual = r.l2_norm() / norm_b;
+        rho0 = r.dot(r, threads);
+        residual = sqrt(rho0) / norm_b;
     }
 
-    p = mul(M_inv, r);
-    z = p; // z0
-
     for(iteration = 1; iteration <= CG_MAX_ITERS; iteration++)
     {
-        q = mul(A, p);
-        if(rank == 0)
-        {
-            rho0 = r.dot(z);
-            alpha = rho0 / p.dot(q);
-            x += p * alpha;
-            r -= q * alpha;
-            residual = r.l2_norm() / norm_b;
-        }
-        z = mul(M_inv, r);
+        MPI_Bcast(&residual, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        if(residual <= CG_EPS) break;
+
+        if(rank == 0) w = LT_trian.solve(p, threads);
+        q = mul(A, w);
         if(rank == 0)
         {
-            rho1 = r.dot(z);
+            L_trian.solve(q.getData(), q.getData(), threads);
+            alpha = rho0 / p.dot(q, threads);
+            x.axpy(alpha, w, threads);
+            r.axpy(-alpha, q, threads);
+            rho1 = r.dot(r, threads);
             beta = rho1 / rho0;
-            p = z + p * beta;
+            p.axpby(1.0, r, beta, threads);
+            residual = sqrt(rho1) / norm_b;
+            rho0 = rho1;
         }
-        MPI_Bcast(&residual, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-        if(residual <= CG_EPS) break;
     }
 
-    if(rank == 0)
-        printf("ITER CNT = %d\n", iteration);
+    if(rank == 0) printf("ITER CNT = %d\n", iteration-1);
+    return x.toSparse();
+}
 
-    return x;
-}
\ No newline at end of file
+// Split preconditioning with the L of ILU
+sparse_vector MpiMatrixHelper::CG_ILU_PRECONDITIONED(const sparse_matrix &A, const sparse_vector &b)
+{
+    sparse_matrix L, U;
+    ILU(A, L, U);
+    return CG_SPLIT(A, b, L);
+}
@@ -3,7 +3,9 @@
 //
 
 #include "mpimatrix.h"
+#include "ilu_matrix.h"
 #include <stdexcept>
+#include <algorithm>
 
 #define DEBUG_MPI_MATRIXHELPER_LU 0
 
@@ -17,23 +19,25 @@ void MpiMatrixHelper::LU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix
     int width = A.getWidth();
     int height = A.getHeight();
 
-    sparse_matrix local(A);
+    sparse_matrix local(A.isSymmetric() ? A.toGeneral() : A.toDir(column_wise, threads));
     // We want to have column wise sparse matrix
-    if (local.getDir() == row_wise) local.toggleDir();
+    if (local.getDir() == row_wise) local.toggleDir(threads);
 
     if (rank == 0)
     {
         if (width < processors_cnt || processors_cnt == 1)
         {
             // Do sequential LU
+            auto cols = local.getVectors();
             for (int k = 0; k < width; k++)
             {
                 for (int i = k + 1; i < height; i++)
-                    local[k][i] /= local[k][k];
+                    cols[k].set(i, cols[k].get(i) / cols[k].get(k));
                 for (int i = k + 1; i < width; i++)
                     for (int j = k + 1; j < height; j++)
-                        local[i][j] = local[i][j] - local[i][k] * local[k][j];
+                        cols[i].set(j, cols[i].get(j) - cols[i].get(k) * cols[k].get(j));
             }
+            local = sparse_matrix(cols, width, height, column_wise);
             done = 1;
         }
 
@@ -42,16 +46,15 @@ void MpiMatrixHelper::LU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix
         if (!done)
         {
             // Split the matrix to submatrices
-            auto matrices = local.splitToN(processors_cnt - 1);
+            auto bounds = local.splitBounds(processors_cnt - 1);
 
             // Send submatrices to processors with their positions and with of original matrix
-            int pos = 0;
             for (int i = 1; i < processors_cnt; i++)
             {
-                sendMatrix(i, matrices[i - 1].first);
+                int pos = bounds[i - 1];
+                sendMatrix(i, local, bounds[i - 1], bounds[i]);
                 MPI_Send(&pos, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
                 MPI_Send(&width, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
-                pos += matrices[i - 1].second;
             }
 
             // Receive result from the last processor and store it as local
@@ -67,6 +70,7 @@ void MpiMatrixHelper::LU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix
         int pos = 0, n = 0;
         local = receiveMatrix(0, column_wise);
         height = local.getHeight();
+        auto cols = local.getVectors();
         MPI_Recv(&pos, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
         MPI_Recv(&n, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
@@ -91,20 +95,22 @@ void MpiMatrixHelper::LU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix
                 if (k >= min)
                 {
                     for (int i = k + 1; i < height; i++)
-                        local[k][i] /= local[k][k];
+                        cols[k].set(i, cols[k].get(i) / cols[k].get(k));
                     for (int i = rank + 1; i < processors_cnt; i++)
-                        sendVector(i, local[k]);
+                        sendVector(i, cols[k]);
                 }
-                else local[k] = receiveVector(MPI_ANY_SOURCE);
+                // Column k comes from its owner - with more than two workers
+                // columns of different ones could arrive out of order
+                else cols[k] = receiveVector(std::min(k / len + 1, processors_cnt - 1));
             }
             for (int i = (((k + 1) > min) ? (k + 1) : min); i <= max; i++)
                 for (int j = k + 1; j < n; j++)
-                    local[i][j] = local[i][j] - local[i][k] * local[k][j];
+                    cols[i].set(j, cols[i].get(j) - cols[i].get(k) * cols[k].get(j));
         }
 
         // Last processor sends result
         if (rank == processors_cnt - 1)
-            sendMatrix(0, local);
+            sendMatrix(0, sparse_matrix(cols, local.getWidth(), height, column_wise));
     }
     if (rank == 0)
     {
@@ -118,35 +124,81 @@ void MpiMatrixHelper::LU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix
     #endif
 }
 
-void MpiMatrixHelper::ILU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix &U)
+// Incomplete factors walk stored items only and take about as long as a few
+// products with A - so they are not worth sending anywhere
+void MpiMatrixHelper::ILU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix &U, const ilu_options &options)
 {
-    #if DEBUG_MPI_MATRIXHELPER_LU
-        if (rank == 0) printf("MpiMatrixHelper: START ILU\n");
-    #endif
+    if (rank != 0) return;
 
-    int done = 0;
-    int width = A.getWidth();
-    int height = A.getHeight();
+    auto factors = ilu_matrix::factorize(A, options);
+    L = factors.getL();
+    U = factors.getU();
+}
 
-    sparse_matrix local(A);
+void MpiMatrixHelper::IC(const sparse_matrix &A, sparse_matrix &L, bool shift)
+{
+    if (rank != 0) return;
 
-    // We want to have column wise sparse matrix
-    if (local.getDir() == row_wise) local.toggleDir();
+    auto factor = shift ? ic_matrix::ic0_shifted(A) : ic_matrix::ic0(A);
+    L = factor.getL();
+}
 
-    if (rank == 0)
+// Rows [begin, end) of row compressed m restricted to columns of the same
+// range, as a square matrix of their own
+static sparse_matrix diagonalBlock(const sparse_matrix &m, int begin, int end)
+{
+    auto &ptr = m.getPtr();
+    auto &idx = m.getIdx();
+    auto &values = m.getValues();
+    vector<sparse_offset> b_ptr(end - begin + 1, 0);
+    vector<int> b_idx;
+    vector<double> b_values;
+    for (int i = begin; i < end; i++)
     {
-        if (width < processors_cnt || processors_cnt == 1)
-        {
-            // Do sequential LU
-            for (int k = 0; k < width; k++)
+        for (sparse_offset k = ptr[i]; k < ptr[i + 1]; k++)
+            if (idx[k] >= begin && idx[k] < end)
             {
-                for (int i = k + 1; i < height; i++)
-                    local[k][i] /= local[k][k];
-                for (int i = k + 1; i < width; i++)
-                    for (int j = k + 1; j < height; j++)
-                        if (local[i][j] != 0)
-                            local[i][j] = local[i][j] - local[i][k] * local[k][j];
+                b_idx.push_back(idx[k] - begin);
+                b_values.push_back(values[k]);
             }
+        b_ptr[i - begin + 1] = b_idx.size();
+    }
+    return sparse_matrix(end - begin, end - begin, row_wise, std::move(b_ptr), std::move(b_idx), std::move(b_values));
+}
+
+// Row compressed square block b put at rows and columns from begin on of an
+// n x n matrix - the form of a part of splitToN
+static sparse_matrix placedBlock(const sparse_matrix &b, int begin, int n)
+{
+    auto &ptr = b.getPtr();
+    int size = b.getHeight();
+    vector<sparse_offset> p_ptr(n + 1, 0);
+    for (int i = begin; i < n; i++)
+        p_ptr[i + 1] = ptr[i - begin < size ? i - begin + 1 : size];
+    vector<int> p_idx(b.getIdx());
+    for (size_t k = 0; k < p_idx.size(); k++)
+        p_idx[k] += begin;
+    return sparse_matrix(n, n, row_wise, std::move(p_ptr), std::move(p_idx), vector<double>(b.getValues()));
+}
+
+// Block Jacobi ILU: every worker factors the diagonal block of its block of
+// rows on its own, dropping items coupling it with other blocks. A weaker
+// preconditioner than ILU of the whole matrix, but blocks need nothing from
+// each other.
+void MpiMatrixHelper::BlockILU(const sparse_matrix &A, sparse_matrix &L, sparse_matrix &U,
+                               const ilu_options &options)
+{
+    int done = 0;
+    int n = A.getHeight();
+
+    if (rank == 0)
+    {
+        if (A.getWidth() != n)
+            throw std::runtime_error("Factorized matrix must be square");
+
+        if (n < processors_cnt || processors_cnt == 1)
+        {
+            ILU(A, L, U, options);
             done = 1;
         }
 
@@ -154,80 +206,55 @@ void MpiMatrixHelper::ILU(const sparse_matrix &A, sparse_matrix &L, sparse_matri
 
         if (!done)
         {
-            // Split the matrix to submatrices
-            auto matrices = local.splitToN(processors_cnt - 1);
+            sparse_matrix rows(A.isSymmetric() ? A.toGeneral() : A.toDir(row_wise, threads));
+            if (rows.getDir() != row_wise) rows.toggleDir(threads);
+            auto bounds = rows.splitBounds(processors_cnt - 1);
 
-            // Send submatrices to processors with their positions and with of original matrix
-            int pos = 0;
             for (int i = 1; i < processors_cnt; i++)
             {
-                sendMatrix(i, matrices[i - 1].first);
-                MPI_Send(&pos, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
-                MPI_Send(&width, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
-                pos += matrices[i - 1].second;
+                int begin = bounds[i - 1], end = bounds[i];
+                sendMatrix(i, rows, begin, end);
+                MPI_Send(&begin, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+                MPI_Send(&end, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+                int type = options.type;
+                MPI_Send(&type, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+                MPI_Send(&options.level, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+                MPI_Send(&options.max_fill, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+                MPI_Send(&options.tau, 1, MPI_DOUBLE, i, 0, MPI_COMM_WORLD);
             }
 
-            // Receive result from the last processor and store it as local
-            local = receiveMatrix(processors_cnt - 1, column_wise);
+            vector<sparse_matrix> l_parts, u_parts;
+            for (int i = 1; i < processors_cnt; i++)
+            {
+                l_parts.push_back(receiveMatrix(i, row_wise));
+                u_parts.push_back(receiveMatrix(i, row_wise));
+            }
+            L = sparse_matrix::join(l_parts);
+            U = sparse_matrix::join(u_parts);
+            L.toggleDir(threads);
+            U.toggleDir(threads);
         }
     }
-    if (rank > 0)
+    else
     {
         MPI_Bcast(&done, 1, MPI_INT, 0, MPI_COMM_WORLD);
         if (done) return;
 
-        // Receive matrix and position
-        int pos = 0, n = 0;
-        local = receiveMatrix(0, column_wise);
-        height = local.getHeight();
-        MPI_Recv(&pos, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        MPI_Recv(&n, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-        int min = pos;
-        int len = n / (processors_cnt - 1);
-        int max = rank == processors_cnt - 1 ? n - 1 : min + len - 1;
-
-    #if DEBUG_MPI_MATRIXHELPER_LU
-        printf("\n");
-        printf("I am proc nr %d and got n = %d and pos = %d\n", rank, n, pos);
-        printf("have min = %d, max = %d and matrix:\n", min, max);
-        local.printSparse();
-        printf("Width = %d, height = %d\n", width, height);
-        printf("\n");
-    #endif
-
-        // Compute
-        for (int k = 0; k < n; k++)
-        {
-            if (k <= max)
-            {
-                if (k >= min)
-                {
-                    for (int i = k + 1; i < height; i++)
-                        local[k][i] /= local[k][k];
-                    for (int i = rank + 1; i < processors_cnt; i++)
-                        sendVector(i, local[k]);
-                }
-                else local[k] = receiveVector(MPI_ANY_SOURCE);
-            }
-            for (int i = (((k + 1) > min) ? (k + 1) : min); i <= max; i++)
-                for (int j = k + 1; j < n; j++)
-                    if (local[i][j] != 0)
-                        local[i][j] = local[i][j] - local[i][k] * local[k][j];
-        }
+        int begin, end, type;
+        ilu_options sent;
+        auto rows = receiveMatrix(0, row_wise);
+        MPI_Recv(&begin, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        MPI_Recv(&end, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        MPI_Recv(&type, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        MPI_Recv(&sent.level, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        MPI_Recv(&sent.max_fill, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        MPI_Recv(&sent.tau, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        sent.type = (ilu_options::kind)type;
 
-        // Last processor sends result
-        if (rank == processors_cnt - 1)
-            sendMatrix(0, local);
-    }
-    if (rank == 0)
-    {
-        // Retrieve L and U matrices
-        L = local.getL();
-        U = local.getU();
+        // Sizes come with the rows - A of workers may be a placeholder
+        n = rows.getHeight();
+        auto factors = ilu_matrix::factorize(diagonalBlock(rows, begin, end), sent);
+        sendMatrix(0, placedBlock(factors.getL(row_wise), begin, n));
+        sendMatrix(0, placedBlock(factors.getU(row_wise), begin, n));
     }
-
-    #if DEBUG_MPI_MATRIXHELPER_LU
-        if (rank == 0) printf("MpiMatrixHelper: END ILU\n");
-    #endif
 }
@@ -7,6 +7,24 @@
 
 #define DEBUG_MPI_MATRIXHELPER_OP 0
 
+// m compressed along dir, and out of symmetric storage when general is set.
+// m itself is handed back when it is in that form already, otherwise the
+// converted copy is made in storage - operands are never copied just to be
+// read.
+static const sparse_matrix &prepared(const sparse_matrix &m, direction dir, bool general,
+                                     sparse_matrix &storage, int threads)
+{
+    if (general && m.isSymmetric())
+    {
+        storage = m.toGeneral();
+        if (storage.getDir() != dir) storage.toggleDir(threads);
+        return storage;
+    }
+    if (m.getDir() == dir) return m;
+    storage = m.toDir(dir, threads);
+    return storage;
+}
+
 sparse_matrix MpiMatrixHelper::add(const sparse_matrix &aa, const sparse_matrix &bb)
 {
     #if DEBUG_MPI_MATRIXHELPER_OP
@@ -14,10 +32,9 @@ sparse_matrix MpiMatrixHelper::add(const sparse_matrix &aa, const sparse_matrix
     #endif
 
     int done = 0;
-    sparse_matrix a(aa);
-    sparse_matrix b(bb);
-
-    if(a.getDir() != b.getDir()) b.toggleDir();
+    sparse_matrix b_storage;
+    const sparse_matrix &a = aa;
+    const sparse_matrix &b = rank == 0 ? prepared(bb, a.getDir(), false, b_storage, threads) : bb;
 
     sparse_matrix result(a.getWidth(), a.getHeight(), column_wise);
 
@@ -26,7 +43,8 @@ sparse_matrix MpiMatrixHelper::add(const sparse_matrix &aa, const sparse_matrix
         if (a.getWidth() != b.getHeight())
             throw std::runtime_error("Dimensions of matrices do not match");
 
-        if (a.getWidth() < processors_cnt || processors_cnt == 1)
+        if (a.getWidth() < processors_cnt || processors_cnt == 1 ||
+            a.isSymmetric() != b.isSymmetric())
         {
             // Do sequential addition
             printf("Doing sequential addition\n");
@@ -39,27 +57,22 @@ sparse_matrix MpiMatrixHelper::add(const sparse_matrix &aa, const sparse_matrix
         if (!done)
         {
             // Do parallel multiplication using MPI
-            auto matrices1 = a.splitToN(processors_cnt - 1);
-            auto matrices2 = b.splitToN(processors_cnt - 1);
+            auto bounds = a.splitBounds(processors_cnt - 1);
 
             for (int i = 1; i < processors_cnt; i++)
             {
-                sendMatrix(i, matrices1[i - 1].first);
-                sendMatrix(i, matrices2[i - 1].first);
+                sendMatrix(i, a, bounds[i - 1], bounds[i]);
+                sendMatrix(i, b, bounds[i - 1], bounds[i]);
             }
 
-            vector<sparse_matrix_elem> elements;
-
+            // Parts hold disjoint blocks of vectors of a, so they are stitched
+            // together as they are instead of going through coordinates
+            vector<sparse_matrix> parts;
             for (int i = 1; i < processors_cnt; i++)
-            {
-                auto part_result = receiveMatrix(i, column_wise).getRawData();
-                elements.insert(
-                        elements.begin(),
-                        part_result.begin(),
-                        part_result.end());
-            }
+                parts.push_back(receiveMatrix(i, a.getDir()));
 
-            result.fill(elements);
+            result = sparse_matrix::join(parts);
+            if (result.getDir() != column_wise) result.toggleDir(threads);
         }
     }
 
@@ -100,7 +113,8 @@ void MpiMatrixHelper::addto(sparse_matrix &to, const sparse_matrix &what)
         if (to.getWidth() != what.getWidth() || to.getHeight() != what.getHeight())
             throw std::runtime_error("Dimensions of matrices do not match");
 
-        if (to.getWidth() < processors_cnt || processors_cnt == 1)
+        if (to.getWidth() < processors_cnt || processors_cnt == 1 ||
+            to.isSymmetric() != what.isSymmetric())
         {
             to += what;
             done = 1;
@@ -111,23 +125,21 @@ void MpiMatrixHelper::addto(sparse_matrix &to, const sparse_matrix &what)
         if (!done)
         {
             // Do parallel multiplication using MPI
-            auto matrices1 = to.splitToN(processors_cnt - 1);
-            auto matrices2 = what.splitToN(processors_cnt - 1);
+            sparse_matrix what_storage;
+            const sparse_matrix &w = prepared(what, to.getDir(), false, what_storage, threads);
+            auto bounds = to.splitBounds(processors_cnt - 1);
 
             for (int i = 1; i < processors_cnt; i++)
             {
-                sendMatrix(i, matrices1[i - 1].first);
-                sendMatrix(i, matrices2[i - 1].first);
+                sendMatrix(i, to, bounds[i - 1], bounds[i]);
+                sendMatrix(i, w, bounds[i - 1], bounds[i]);
             }
 
-            vector<sparse_matrix_elem> elements;
+            vector<sparse_matrix> parts;
             for (int i = 1; i < processors_cnt; i++)
-            {
-                auto part_result = receiveMatrix(i, column_wise).getRawData();
-                elements.insert(elements.begin(), part_result.begin(), part_result.end());
-            }
+                parts.push_back(receiveMatrix(i, to.getDir()));
 
-            to.fill(elements);
+            to = sparse_matrix::join(parts);
         }
     }
     else
@@ -145,9 +157,11 @@ void MpiMatrixHelper::addto(sparse_matrix &to, const sparse_matrix &what)
     }
 }
 
-sparse_matrix MpiMatrixHelper::sub(const sparse_matrix &a, const sparse_matrix &b)
+sparse_matrix MpiMatrixHelper::sub(const sparse_matrix &a, const sparse_matrix &bb)
 {
     int done = 0;
+    sparse_matrix b_storage;
+    const sparse_matrix &b = rank == 0 ? prepared(bb, a.getDir(), false, b_storage, threads) : bb;
     sparse_matrix result(a.getWidth(), a.getHeight(), column_wise);
 
     if (rank == 0)
@@ -155,7 +169,8 @@ sparse_matrix MpiMatrixHelper::sub(const sparse_matrix &a, const sparse_matrix &
         if (a.getWidth() != b.getHeight())
             throw std::runtime_error("Dimensions of matrices do not match");
 
-        if (a.getWidth() < processors_cnt || processors_cnt == 1)
+        if (a.getWidth() < processors_cnt || processors_cnt == 1 ||
+            a.isSymmetric() != b.isSymmetric())
         {
             // Do sequential addition
             result = a - b;
@@ -167,27 +182,22 @@ sparse_matrix MpiMatrixHelper::sub(const sparse_matrix &a, const sparse_matrix &
         if (!done)
         {
             // Do parallel multiplication using MPI
-            auto matrices1 = a.splitToN(processors_cnt - 1);
-            auto matrices2 = b.splitToN(processors_cnt - 1);
+            auto bounds = a.splitBounds(processors_cnt - 1);
 
             for (int i = 1; i < processors_cnt; i++)
             {
-                sendMatrix(i, matrices1[i - 1].first);
-                sendMatrix(i, matrices2[i - 1].first);
+                sendMatrix(i, a, bounds[i - 1], bounds[i]);
+                sendMatrix(i, b, bounds[i - 1], bounds[i]);
             }
 
-            vector<sparse_matrix_elem> elements;
-
+            // Parts hold disjoint blocks of vectors of a, so they are stitched
+            // together as they are instead of going through coordinates
+            vector<sparse_matrix> parts;
             for (int i = 1; i < processors_cnt; i++)
-            {
-                auto part_result = receiveMatrix(i, column_wise).getRawData();
-                elements.insert(
-                        elements.begin(),
-                        part_result.begin(),
-                        part_result.end());
-            }
+                parts.push_back(receiveMatrix(i, a.getDir()));
 
-            result.fill(elements);
+            result = sparse_matrix::join(parts);
+            if (result.getDir() != column_wise) result.toggleDir(threads);
         }
     }
 
@@ -216,7 +226,8 @@ void MpiMatrixHelper::subto(sparse_matrix &to, const sparse_matrix &what)
         if (to.getWidth() != what.getWidth() || to.getHeight() != what.getHeight())
             throw std::runtime_error("Dimensions of matrices do not match");
 
-        if (to.getWidth() < processors_cnt || processors_cnt == 1)
+        if (to.getWidth() < processors_cnt || processors_cnt == 1 ||
+            to.isSymmetric() != what.isSymmetric())
         {
             to -= what;
             done = 1;
@@ -227,23 +238,21 @@ void MpiMatrixHelper::subto(sparse_matrix &to, const sparse_matrix &what)
         if (!done)
         {
             // Do parallel multiplication using MPI
-            auto matrices1 = to.splitToN(processors_cnt - 1);
-            auto matrices2 = what.splitToN(processors_cnt - 1);
+            sparse_matrix what_storage;
+            const sparse_matrix &w = prepared(what, to.getDir(), false, what_storage, threads);
+            auto bounds = to.splitBounds(processors_cnt - 1);
 
             for (int i = 1; i < processors_cnt; i++)
             {
-                sendMatrix(i, matrices1[i - 1].first);
-                sendMatrix(i, matrices2[i - 1].first);
+                sendMatrix(i, to, bounds[i - 1], bounds[i]);
+                sendMatrix(i, w, bounds[i - 1], bounds[i]);
             }
 
-            vector<sparse_matrix_elem> elements;
+            vector<sparse_matrix> parts;
             for (int i = 1; i < processors_cnt; i++)
-            {
-                auto part_result = receiveMatrix(i, column_wise).getRawData();
-                elements.insert(elements.begin(), part_result.begin(), part_result.end());
-            }
+                parts.push_back(receiveMatrix(i, to.getDir()));
 
-            to.fill(elements);
+            to = sparse_matrix::join(parts);
         }
     }
     else
@@ -268,14 +277,13 @@ sparse_matrix MpiMatrixHelper::mul(const sparse_matrix &aa, const sparse_matrix
     #endif
 
     int done = 0;
-    sparse_matrix a(aa);
-    sparse_matrix b(bb);
+    // Blocks of a symmetric matrix do not multiply as blocks of the whole one
+    sparse_matrix a_storage, b_storage;
+    const sparse_matrix &a = rank == 0 ? prepared(aa, column_wise, true, a_storage, threads) : aa;
+    const sparse_matrix &b = rank == 0 ? prepared(bb, row_wise, true, b_storage, threads) : bb;
 
     sparse_matrix result(b.getWidth(), a.getHeight(), column_wise);
 
-    if(a.getDir() == row_wise) a.toggleDir();
-    if(b.getDir() == column_wise) b.toggleDir();
-
     if (rank == 0)
     {
         if (a.getWidth() != b.getHeight())
@@ -285,7 +293,7 @@ sparse_matrix MpiMatrixHelper::mul(const sparse_matrix &aa, const sparse_matrix
         {
             // Do sequential multiplication
             printf("Doing sequential multiplication!\n");
-            result = a * b;
+            result = a.multiply(b, threads);
             done = 1;
         }
 
@@ -294,13 +302,12 @@ sparse_matrix MpiMatrixHelper::mul(const sparse_matrix &aa, const sparse_matrix
         if (!done)
         {
             // Do parallel multiplication using MPI
-            auto matrices_col = a.splitToN(processors_cnt - 1);
-            auto matrices_row = b.splitToN(processors_cnt - 1);
+            auto bounds = a.splitBounds(processors_cnt - 1);
 
             for (int i = 1; i < processors_cnt; i++)
             {
-                sendMatrix(i, matrices_col[i - 1].first);
-                sendMatrix(i, matrices_row[i - 1].first);
+                sendMatrix(i, a, bounds[i - 1], bounds[i]);
+                sendMatrix(i, b, bounds[i - 1], bounds[i]);
             }
 
             for (int i = 1; i < processors_cnt; i++)
@@ -325,7 +332,7 @@ sparse_matrix MpiMatrixHelper::mul(const sparse_matrix &aa, const sparse_matrix
 			row_matrix.printSparse();
     #endif
 
-            result = col_matrix * row_matrix;
+            result = col_matrix.multiply(row_matrix, threads);
             sendMatrix(0, result);
         }
     }
@@ -337,10 +344,68 @@ sparse_matrix MpiMatrixHelper::mul(const sparse_matrix &aa, const sparse_matrix
     return result;
 }
 
+// a * b^T as a sum of products of column blocks of a and of b - a block of
+// columns of b is a block of rows of b^T, so b^T is never built
+sparse_matrix MpiMatrixHelper::mul(const sparse_matrix &a, const transposed_matrix &b)
+{
+    int done = 0;
+    sparse_matrix result(b.getWidth(), a.getHeight(), column_wise);
+
+    if (rank == 0)
+    {
+        if (a.getWidth() != b.getHeight())
+            throw std::runtime_error("Dimensions of matrices do not match");
+
+        if (a.getWidth() < processors_cnt || processors_cnt == 1)
+        {
+            // Do sequential multiplication
+            result = a.multiply(b, threads);
+            done = 1;
+        }
+
+        MPI_Bcast(&done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        if (!done)
+        {
+            // Both are cut into blocks of consecutive columns
+            sparse_matrix a_storage, b_storage;
+            const sparse_matrix &a_col = prepared(a, column_wise, true, a_storage, threads);
+            const sparse_matrix &b_col = prepared(b.matrix(), column_wise, true, b_storage, threads);
+            auto bounds = a_col.splitBounds(processors_cnt - 1);
+
+            for (int i = 1; i < processors_cnt; i++)
+            {
+                sendMatrix(i, a_col, bounds[i - 1], bounds[i]);
+                sendMatrix(i, b_col, bounds[i - 1], bounds[i]);
+            }
+
+            for (int i = 1; i < processors_cnt; i++)
+                result += receiveMatrix(i, column_wise);
+        }
+    }
+
+    if (rank != 0)
+    {
+        MPI_Bcast(&done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        if (!done)
+        {
+            // Block of b compressed by rows is its transposition by columns
+            sparse_matrix col_matrix = receiveMatrix(0, column_wise);
+            sparse_matrix row_matrix = receiveMatrix(0, row_wise);
+
+            result = col_matrix.multiply(row_matrix.transposed(), threads);
+            sendMatrix(0, result);
+        }
+    }
+
+    return result;
+}
+
 sparse_vector MpiMatrixHelper::mul(const sparse_matrix &A, const sparse_vector &x)
 {
     int done = 0;
-    sparse_vector result(x.size(), column_wise);
+    sparse_vector result(A.getHeight(), column_wise);
 
     if (rank == 0)
     {
@@ -350,7 +415,7 @@ sparse_vector MpiMatrixHelper::mul(const sparse_matrix &A, const sparse_vector &
         if (A.getWidth() < processors_cnt || processors_cnt == 1)
         {
             // Do sequential multiplication
-            result = A * x;
+            result = A.multiply(x, threads);
             done = 1;
         }
 
@@ -359,12 +424,12 @@ sparse_vector MpiMatrixHelper::mul(const sparse_matrix &A, const sparse_vector &
         if (!done)
         {
             // Do parallel multiplication using MPI
-            auto matrices_col = A.splitToN(processors_cnt - 1);
+            auto bounds = A.splitBounds(processors_cnt - 1);
 
             for (int i = 1; i < processors_cnt; i++)
             {
                 sendVector(i, x);
-                sendMatrix(i, matrices_col[i - 1].first);
+                sendMatrix(i, A, bounds[i - 1], bounds[i]);
             }
 
             for (int i = 1; i < processors_cnt; i++)
@@ -381,7 +446,7 @@ sparse_vector MpiMatrixHelper::mul(const sparse_matrix &A, const sparse_vector &
             sparse_vector vec = receiveVector(0);
             sparse_matrix col_matrix = receiveMatrix(0, column_wise);
 
-            result = col_matrix * vec;
+            result = col_matrix.multiply(vec, threads);
 
             sendVector(0, result);
         }
@@ -389,3 +454,163 @@ sparse_vector MpiMatrixHelper::mul(const sparse_matrix &A, const sparse_vector &
 
     return result;
 }
+
+dense_vector MpiMatrixHelper::mul(const sparse_matrix &A, const dense_vector &x)
+{
+    int done = 0;
+    dense_vector result(A.getHeight(), column_wise);
+
+    if (rank == 0)
+    {
+        if (A.getWidth() != x.size())
+            throw std::runtime_error("Dimensions of matrices do not match");
+
+        if (A.getWidth() < processors_cnt || processors_cnt == 1)
+        {
+            // Do sequential multiplication
+            result = A.multiply(x, threads);
+            done = 1;
+        }
+
+        MPI_Bcast(&done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        if (!done)
+        {
+            // Do parallel multiplication using MPI
+            auto bounds = A.splitBounds(processors_cnt - 1);
+
+            for (int i = 1; i < processors_cnt; i++)
+            {
+                sendVector(i, x);
+                sendMatrix(i, A, bounds[i - 1], bounds[i]);
+            }
+
+            for (int i = 1; i < processors_cnt; i++)
+                receiveDenseVectorAdd(i, result);
+        }
+    }
+
+    if (rank != 0)
+    {
+        MPI_Bcast(&done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        if (!done)
+        {
+            dense_vector vec = receiveDenseVector(0);
+            sparse_matrix col_matrix = receiveMatrix(0, column_wise);
+
+            result = col_matrix.multiply(vec, threads);
+
+            sendVector(0, result);
+        }
+    }
+
+    return result;
+}
+
+
+// Every rank gets a block of stored vectors of A and computes the part of
+// A^T * x they give, gathering over columns or scattering over rows
+sparse_vector MpiMatrixHelper::mul(const transposed_matrix &A, const sparse_vector &x)
+{
+    int done = 0;
+    sparse_vector result(A.getHeight(), column_wise);
+
+    if (rank == 0)
+    {
+        if (A.getWidth() != x.size())
+            throw std::runtime_error("Dimensions of matrices do not match");
+
+        if (A.getWidth() < processors_cnt || processors_cnt == 1)
+        {
+            // Do sequential multiplication
+            result = A.multiply(x, threads);
+            done = 1;
+        }
+
+        MPI_Bcast(&done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        if (!done)
+        {
+            auto bounds = A.matrix().splitBounds(processors_cnt - 1);
+
+            for (int i = 1; i < processors_cnt; i++)
+            {
+                sendVector(i, x);
+                sendMatrix(i, A.matrix(), bounds[i - 1], bounds[i]);
+            }
+
+            for (int i = 1; i < processors_cnt; i++)
+                result += receiveVector(i);
+        }
+    }
+
+    if (rank != 0)
+    {
+        MPI_Bcast(&done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        if (!done)
+        {
+            sparse_vector vec = receiveVector(0);
+            sparse_matrix matrix = receiveMatrix(0, column_wise);
+
+            result = matrix.transposed().multiply(vec, threads);
+
+            sendVector(0, result);
+        }
+    }
+
+    return result;
+}
+
+dense_vector MpiMatrixHelper::mul(const transposed_matrix &A, const dense_vector &x)
+{
+    int done = 0;
+    dense_vector result(A.getHeight(), column_wise);
+
+    if (rank == 0)
+    {
+        if (A.getWidth() != x.size())
+            throw std::runtime_error("Dimensions of matrices do not match");
+
+        if (A.getWidth() < processors_cnt || processors_cnt == 1)
+        {
+            // Do sequential multiplication
+            result = A.multiply(x, threads);
+            done = 1;
+        }
+
+        MPI_Bcast(&done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        if (!done)
+        {
+            auto bounds = A.matrix().splitBounds(processors_cnt - 1);
+
+            for (int i = 1; i < processors_cnt; i++)
+            {
+                sendVector(i, x);
+                sendMatrix(i, A.matrix(), bounds[i - 1], bounds[i]);
+            }
+
+            for (int i = 1; i < processors_cnt; i++)
+                receiveDenseVectorAdd(i, result);
+        }
+    }
+
+    if (rank != 0)
+    {
+        MPI_Bcast(&done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        if (!done)
+        {
+            dense_vector vec = receiveDenseVector(0);
+            sparse_matrix matrix = receiveMatrix(0, column_wise);
+
+            result = matrix.transposed().multiply(vec, threads);
+
+            sendVector(0, result);
+        }
+    }
+
+    return result;
+}
\ No newline at end of file
@@ -3,24 +3,13 @@
 //
 
 #include "mpimatrix.h"
+#include "trian_matrix.h"
 
 
 // Solves A * x = b where A is lower triangular matrix
 sparse_vector MpiMatrixHelper::solveTrian(const sparse_matrix &A, const sparse_vector &b)
 {
-    int n = b.size();
-    sparse_vector x(n);
-
-    // Solve L
-    for (int r = 0; r < n; ++r)
-    {
-        auto sum = 0.0f;
-        for (int c = 0; c < r; ++c)
-            sum += A[c][r] * x[c];
-        x[r] = (b[r] - sum) / A[r][r];
-    }
-
-    return x;
+    return trian_matrix(A, lower_triangle).solve(dense_vector(b), threads).toSparse();
 }
 
 // Solves multiple linear equations: A * X = B where A is lower triangular
@@ -37,11 +26,11 @@ sparse_matrix MpiMatrixHelper::SolveManyTrian(const sparse_matrix &A, const spar
         if(n < processors_cnt || processors_cnt == 1)
         {
             // Solve sequentially
+            trian_matrix A_trian(A, lower_triangle);
+            vector<sparse_vector> solutions;
             for(int i=0; i<B.getWidth(); i++)
-            {
-                auto solution = solveTrian(A, B[i]);
-                result[i] = solution;
-            }
+                solutions.push_back(A_trian.solve(dense_vector(B[i]), threads).toSparse());
+            result = sparse_matrix(solutions, B.getWidth(), B.getHeight(), column_wise);
 
             done = 1;
         }
@@ -50,15 +39,14 @@ sparse_matrix MpiMatrixHelper::SolveManyTrian(const sparse_matrix &A, const spar
 
         if (!done)
         {
-            int pos = 0;
-            auto b_parts = B.splitToN(processors_cnt - 1);
+            auto bounds = B.splitBounds(processors_cnt - 1);
             for (int i = 1; i < processors_cnt; i++)
             {
+                int begin = bounds[i - 1], end = bounds[i];
                 sendMatrix(i, A);
-                sendMatrix(i, b_parts[i - 1].first);
-                MPI_Send(&pos, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
-                pos += b_parts[i - 1].second;
-                MPI_Send(&pos, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+                sendMatrix(i, B, begin, end);
+                MPI_Send(&begin, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+                MPI_Send(&end, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
             }
 
             for (int i = 1; i < processors_cnt; i++)
@@ -78,17 +66,15 @@ sparse_matrix MpiMatrixHelper::SolveManyTrian(const sparse_matrix &A, const spar
             MPI_Recv(&from, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
             MPI_Recv(&to, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
-            sparse_matrix part_result(right.getWidth(), right.getHeight(), column_wise);
+            vector<sparse_vector> part_result(right.getWidth());
 
 //            printf("I am %d from = %d to = %d\n", rank, from, to);
 
+            trian_matrix left_trian(left, lower_triangle);
             for(int i=from; i<to; i++)
-            {
-                auto solution = solveTrian(left, right[i]);
-                part_result[i] = solution;
-            }
+                part_result[i] = left_trian.solve(dense_vector(right[i]), threads).toSparse();
 
-            sendMatrix(0, part_result);
+            sendMatrix(0, sparse_matrix(part_result, right.getWidth(), right.getHeight(), column_wise));
         }
     }
 
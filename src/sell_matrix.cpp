@@ -0,0 +1,172 @@
+#include "sell_matrix.h"
+#include <string.h>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+
+// CONSTRUCTORS
+
+sell_matrix::sell_matrix()
+		: width(0), height(0), sigma(SELL_SIGMA), chunks(0), chunk_ptr(1, 0), val(nullptr)
+{ }
+
+sell_matrix::sell_matrix(const sparse_matrix &m, int sigma)
+		: width(m.getWidth()), height(m.getHeight()), sigma(sigma), val(nullptr)
+{
+	if (sigma < 1)
+		throw std::runtime_error("sigma must be positive");
+
+	// Items are read row by row
+	sparse_matrix row_matrix(m.isSymmetric() ? m.toGeneral() : m.toDir(row_wise));
+	if (row_matrix.getDir() != row_wise) row_matrix.toggleDir();
+	auto &ptr = row_matrix.getPtr();
+	auto &idx = row_matrix.getIdx();
+	auto &values = row_matrix.getValues();
+
+	// Sort rows by length, longest first, within every window of sigma rows
+	chunks = (height + SELL_C - 1) / SELL_C;
+	rows.assign((size_t)chunks * SELL_C, -1);
+	for (int i = 0; i < height; i++)
+		rows[i] = i;
+	for (int begin = 0; begin < height; begin += sigma)
+	{
+		int end = std::min(begin + sigma, height);
+		std::stable_sort(rows.begin() + begin, rows.begin() + end, [&ptr](int a, int b)
+		{ return ptr[a + 1] - ptr[a] > ptr[b + 1] - ptr[b]; });
+	}
+
+	chunk_ptr.assign(chunks + 1, 0);
+	chunk_len.assign(chunks, 0);
+	for (int c = 0; c < chunks; c++)
+	{
+		for (int r = 0; r < SELL_C; r++)
+		{
+			int i = rows[c * SELL_C + r];
+			if (i >= 0) chunk_len[c] = std::max(chunk_len[c], (int)(ptr[i + 1] - ptr[i]));
+		}
+		chunk_ptr[c + 1] = chunk_ptr[c] + (sparse_offset)chunk_len[c] * SELL_C;
+	}
+
+	// Padding points at column 0 with value 0, so it is safe to gather
+	sparse_offset size = chunk_ptr[chunks];
+	col.assign(size, 0);
+	val = simd_alloc(size);
+	if (size) memset(val, 0, size * sizeof(double));
+	for (int c = 0; c < chunks; c++)
+		for (int r = 0; r < SELL_C; r++)
+		{
+			int i = rows[c * SELL_C + r];
+			if (i < 0) continue;
+			int j = 0;
+			for (sparse_offset k = ptr[i]; k < ptr[i + 1]; k++, j++)
+			{
+				col[chunk_ptr[c] + j * SELL_C + r] = idx[k];
+				val[chunk_ptr[c] + j * SELL_C + r] = values[k];
+			}
+		}
+}
+
+sell_matrix::sell_matrix(const sell_matrix &other)
+		: width(other.width), height(other.height), sigma(other.sigma), chunks(other.chunks),
+		  chunk_ptr(other.chunk_ptr), chunk_len(other.chunk_len), rows(other.rows), col(other.col),
+		  val(simd_alloc(other.getSize()))
+{
+	if (getSize()) memcpy(val, other.val, getSize() * sizeof(double));
+}
+
+sell_matrix::sell_matrix(sell_matrix &&other)
+		: width(other.width), height(other.height), sigma(other.sigma), chunks(other.chunks),
+		  chunk_ptr(std::move(other.chunk_ptr)), chunk_len(std::move(other.chunk_len)),
+		  rows(std::move(other.rows)), col(std::move(other.col)), val(other.val)
+{
+	other.val = nullptr;
+	other.chunks = 0;
+	other.chunk_ptr.assign(1, 0);
+}
+
+sell_matrix::~sell_matrix()
+{ simd_free(val); }
+
+sell_matrix &sell_matrix::operator=(const sell_matrix &other)
+{
+	if (this == &other) return *this;
+	sell_matrix tmp(other);
+	return *this = std::move(tmp);
+}
+
+sell_matrix &sell_matrix::operator=(sell_matrix &&other)
+{
+	width = other.width;
+	height = other.height;
+	sigma = other.sigma;
+	std::swap(chunks, other.chunks);
+	chunk_ptr.swap(other.chunk_ptr);
+	chunk_len.swap(other.chunk_len);
+	rows.swap(other.rows);
+	col.swap(other.col);
+	std::swap(val, other.val);
+	return *this;
+}
+
+// KERNELS
+
+// Computes rows of chunk c into out[0..SELL_C)
+static inline void chunk_kernel(const double *val, const int *col, int len, const double *x, double *out)
+{
+#ifdef SIMD_WIDTH
+	simd_t acc = simd_zero();
+	for (int j = 0; j < len; j++)
+		acc = simd_fmadd(simd_load(val + j * SELL_C), simd_gather(x, col + j * SELL_C), acc);
+	simd_store(out, acc);
+#else
+	for (int r = 0; r < SELL_C; r++)
+		out[r] = 0.;
+	for (int j = 0; j < len; j++)
+		for (int r = 0; r < SELL_C; r++)
+			out[r] += val[j * SELL_C + r] * x[col[j * SELL_C + r]];
+#endif
+}
+
+dense_vector sell_matrix::operator*(const dense_vector &v) const
+{
+	return multiply(v, 1);
+}
+
+// Chunks write disjoint rows, so threads simply share them out
+dense_vector sell_matrix::multiply(const dense_vector &v, int threads) const
+{
+	if (v.size() != width)
+		throw std::runtime_error("Dimensions of matrix and vector do not match");
+
+	dense_vector result(height, v.getDir());
+	double *y = result.getData();
+	const double *x = v.getData();
+
+	#pragma omp parallel for num_threads(threads) schedule(static) if(threads > 1)
+	for (int c = 0; c < chunks; c++)
+	{
+		alignas(SIMD_ALIGNMENT) double out[SELL_C];
+		chunk_kernel(val + chunk_ptr[c], col.data() + chunk_ptr[c], chunk_len[c], x, out);
+		for (int r = 0; r < SELL_C; r++)
+		{
+			int i = rows[c * SELL_C + r];
+			if (i >= 0) y[i] = out[r];
+		}
+	}
+
+	return result;
+}
+
+// GETTERS
+
+int sell_matrix::getWidth() const
+{ return width; }
+
+int sell_matrix::getHeight() const
+{ return height; }
+
+int sell_matrix::getSigma() const
+{ return sigma; }
+
+sparse_offset sell_matrix::getSize() const
+{ return chunk_ptr[chunks]; }
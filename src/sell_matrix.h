@@ -0,0 +1,67 @@
+#ifndef MPI_MATRICES_SELL_MATRIX_H
+#define MPI_MATRICES_SELL_MATRIX_H
+
+#include <vector>
+#include "sparse_matrix.h"
+#include "dense_vector.h"
+#include "simd.h"
+
+// Rows of a chunk - one SIMD register of doubles
+#ifdef SIMD_WIDTH
+	#define SELL_C SIMD_WIDTH
+#else
+	#define SELL_C 4
+#endif
+
+// Rows sorted by length together - enough to even out chunks of meshes with
+// rows of 5-30 nonzeros while keeping the rows close to where they were
+#define SELL_SIGMA 256
+
+// Sliced ELLPACK (SELL-C-sigma) copy of a matrix for vectorized SpMV. Rows
+// go in chunks of SELL_C, every chunk stored column after column and padded
+// to its longest row, so one SIMD register holds an item of every row of the
+// chunk. Within windows of sigma rows, rows are sorted by length to keep
+// padding small, and the result is scattered back to the original order.
+class sell_matrix
+{
+// FIELDS
+private:
+	int width;
+	int height;
+	int sigma;
+	int chunks;
+
+	// Chunk c keeps chunk_len[c] columns of SELL_C items starting at
+	// chunk_ptr[c] in col and val. Slot r of chunk c holds row
+	// rows[c * SELL_C + r], or -1 past the last row.
+	std::vector<sparse_offset> chunk_ptr;
+	std::vector<int> chunk_len;
+	std::vector<int> rows;
+	std::vector<int> col;
+	double *val;
+
+// CONSTRUCTORS
+public:
+	sell_matrix();
+	explicit sell_matrix(const sparse_matrix &m, int sigma = SELL_SIGMA);
+	sell_matrix(const sell_matrix &other);
+	sell_matrix(sell_matrix &&other);
+	~sell_matrix();
+
+// OPERATORS
+public:
+	sell_matrix &operator=(const sell_matrix &other);
+	sell_matrix &operator=(sell_matrix &&other);
+	dense_vector operator*(const dense_vector &v) const;
+
+// METHODS
+public:
+	dense_vector multiply(const dense_vector &v, int threads) const;
+	int getWidth() const;
+	int getHeight() const;
+	int getSigma() const;
+	// Stored items including padding
+	sparse_offset getSize() const;
+};
+
+#endif //MPI_MATRICES_SELL_MATRIX_H
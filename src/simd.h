@@ -0,0 +1,71 @@
+#ifndef MPI_MATRICES_SIMD_H
+#define MPI_MATRICES_SIMD_H
+
+#include <stdlib.h>
+#include <new>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Alignment of dense buffers - one cache line, enough for any SIMD load
+#define SIMD_ALIGNMENT 64
+
+// Vector primitives used by dense kernels. SIMD_WIDTH (doubles per register)
+// is left undefined when no supported instruction set is enabled, so kernels
+// can fall back to scalar loops with #ifdef SIMD_WIDTH.
+#if defined(__AVX512F__)
+	#define SIMD_WIDTH 8
+	typedef __m512d simd_t;
+	#define simd_load(p) _mm512_load_pd(p)
+	#define simd_store(p, v) _mm512_store_pd(p, v)
+	#define simd_set1(d) _mm512_set1_pd(d)
+	#define simd_zero() _mm512_setzero_pd()
+	#define simd_mul(a, b) _mm512_mul_pd(a, b)
+	#define simd_fmadd(a, b, c) _mm512_fmadd_pd(a, b, c)
+	#define simd_add(a, b) _mm512_add_pd(a, b)
+	// Loads base[index[0]], ..., base[index[7]] for 32-bit indices
+	#define simd_gather(base, index) _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *)(index)), base, 8)
+	static inline double simd_hsum(simd_t v) { return _mm512_reduce_add_pd(v); }
+#elif defined(__AVX2__)
+	#define SIMD_WIDTH 4
+	typedef __m256d simd_t;
+	#define simd_load(p) _mm256_load_pd(p)
+	#define simd_store(p, v) _mm256_store_pd(p, v)
+	#define simd_set1(d) _mm256_set1_pd(d)
+	#define simd_zero() _mm256_setzero_pd()
+	#define simd_mul(a, b) _mm256_mul_pd(a, b)
+	#define simd_add(a, b) _mm256_add_pd(a, b)
+	#define simd_gather(base, index) _mm256_i32gather_pd(base, _mm_loadu_si128((const __m128i *)(index)), 8)
+	#if defined(__FMA__)
+		#define simd_fmadd(a, b, c) _mm256_fmadd_pd(a, b, c)
+	#else
+		#define simd_fmadd(a, b, c) _mm256_add_pd(_mm256_mul_pd(a, b), c)
+	#endif
+	static inline double simd_hsum(simd_t v)
+	{
+		__m128d lo = _mm256_castpd256_pd128(v);
+		__m128d hi = _mm256_extractf128_pd(v, 1);
+		lo = _mm_add_pd(lo, hi);
+		return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+	}
+#endif
+
+// Allocates n doubles aligned to SIMD_ALIGNMENT, rounded up to whole cache
+// lines so aligned loads of the last full register stay in bounds
+static inline double *simd_alloc(size_t n)
+{
+	if (n == 0) return nullptr;
+	void *ptr = nullptr;
+	size_t bytes = ((n * sizeof(double) + SIMD_ALIGNMENT - 1) / SIMD_ALIGNMENT) * SIMD_ALIGNMENT;
+	if (posix_memalign(&ptr, SIMD_ALIGNMENT, bytes) != 0)
+		throw std::bad_alloc();
+	return static_cast<double *>(ptr);
+}
+
+static inline void simd_free(double *ptr)
+{
+	free(ptr);
+}
+
+#endif //MPI_MATRICES_SIMD_H
@@ -0,0 +1,65 @@
+#ifndef MPI_MATRICES_SPARSE_KERNELS_H
+#define MPI_MATRICES_SPARSE_KERNELS_H
+
+#include <vector>
+
+// Two-pointer kernels on sorted (index, value) arrays, as kept by
+// sparse_vector and by every vector of a compressed sparse_matrix.
+
+// Appends x + a * y to (idx, values), dropping items that cancel out to zero
+template <typename V, typename I>
+void sparse_axpy(const I *x_idx, const V *x_val, I x_nnz,
+				 double a, const I *y_idx, const V *y_val, I y_nnz,
+				 std::vector<I> &idx, std::vector<V> &values)
+{
+	I i = 0, j = 0;
+	while (i < x_nnz && j < y_nnz)
+	{
+		if (x_idx[i] < y_idx[j])
+		{
+			idx.push_back(x_idx[i]);
+			values.push_back(x_val[i++]);
+		}
+		else if (y_idx[j] < x_idx[i])
+		{
+			idx.push_back(y_idx[j]);
+			values.push_back(a * y_val[j++]);
+		}
+		else
+		{
+			V value = x_val[i] + a * y_val[j];
+			if (value != 0)
+			{
+				idx.push_back(x_idx[i]);
+				values.push_back(value);
+			}
+			i++;
+			j++;
+		}
+	}
+	idx.insert(idx.end(), x_idx + i, x_idx + x_nnz);
+	values.insert(values.end(), x_val + i, x_val + x_nnz);
+	for (; j < y_nnz; j++)
+	{
+		idx.push_back(y_idx[j]);
+		values.push_back(a * y_val[j]);
+	}
+}
+
+// Sum of x_i * y_i over positions stored in both x and y, accumulated in double
+template <typename V, typename I>
+double sparse_dot(const I *x_idx, const V *x_val, I x_nnz,
+				  const I *y_idx, const V *y_val, I y_nnz)
+{
+	double result = 0.;
+	I i = 0, j = 0;
+	while (i < x_nnz && j < y_nnz)
+	{
+		if (x_idx[i] < y_idx[j]) i++;
+		else if (y_idx[j] < x_idx[i]) j++;
+		else result += (double)x_val[i++] * y_val[j++];
+	}
+	return result;
+}
+
+#endif //MPI_MATRICES_SPARSE_KERNELS_H
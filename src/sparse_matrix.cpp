@@ -7,156 +7,377 @@
 #include <sstream>
 #include <map>
 #include "sparse_matrix.h"
+#include "arena.h"
 #include <stdexcept>
 #include <iostream>
+#include <algorithm>
+#include <utility>
+#include <math.h>
 
 using namespace std;
 
-sparse_matrix::sparse_matrix(vector<sparse_matrix_elem> elements, int width, int height, direction d)
-		: dir(d), width(width), height(height)
-{ fill(elements); }
+template <typename V, typename I>
+basic_sparse_matrix<V, I>::basic_sparse_matrix(vector<elem_type> elements, I width, I height, direction d)
+		: dir(d), width(width), height(height), symmetric(false)
+{ fill(std::move(elements)); }
 
-sparse_matrix::sparse_matrix(const sparse_matrix &m)
+template <typename V, typename I>
+basic_sparse_matrix<V, I>::basic_sparse_matrix(const vector<vector_type> &vectors, I width, I height, direction d)
+		: dir(d), width(width), height(height), symmetric(false)
+{
+	init();
+	I n = vectors.size() < majorSize() ? vectors.size() : majorSize();
+	for (I i = 0; i < n; i++)
+	{
+		for (auto it = vectors[i].cbegin(); it != vectors[i].cend(); it++)
+		{
+			if (it->second == 0) continue;
+			idx.push_back(it->first);
+			values.push_back(it->second);
+		}
+		ptr[i + 1] = idx.size();
+	}
+	for (I i = n; i < majorSize(); i++)
+		ptr[i + 1] = idx.size();
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I>::basic_sparse_matrix(I width, I height, direction d,
+							 vector<offset_type> ptr, vector<I> idx, vector<V> values, bool symmetric)
+		: dir(d), width(width), height(height), symmetric(symmetric),
+		  ptr(std::move(ptr)), idx(std::move(idx)), values(std::move(values))
+{ }
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I>::basic_sparse_matrix(const basic_sparse_matrix &m)
 {
 	dir = m.dir;
-	data = m.data;
 	width = m.width;
 	height = m.height;
+	symmetric = m.symmetric;
+	ptr = m.ptr;
+	idx = m.idx;
+	values = m.values;
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I>::basic_sparse_matrix(basic_sparse_matrix &&m)
+		: dir(m.dir), width(m.width), height(m.height), symmetric(m.symmetric),
+		  ptr(std::move(m.ptr)), idx(std::move(m.idx)), values(std::move(m.values))
+{
+	m.width = 0;
+	m.height = 0;
+	m.symmetric = false;
+	m.init();
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I> &basic_sparse_matrix<V, I>::operator=(const basic_sparse_matrix &m)
+{
+	if (this == &m) return *this;
+	basic_sparse_matrix tmp(m);
+	return *this = std::move(tmp);
 }
 
-sparse_matrix::sparse_matrix(int width, int height, direction d) : dir(d), width(width), height(height)
+template <typename V, typename I>
+basic_sparse_matrix<V, I> &basic_sparse_matrix<V, I>::operator=(basic_sparse_matrix &&m)
+{
+	std::swap(dir, m.dir);
+	std::swap(width, m.width);
+	std::swap(height, m.height);
+	std::swap(symmetric, m.symmetric);
+	ptr.swap(m.ptr);
+	idx.swap(m.idx);
+	values.swap(m.values);
+	return *this;
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I>::basic_sparse_matrix(I width, I height, direction d)
+		: dir(d), width(width), height(height), symmetric(false)
 { init(); }
 
-sparse_matrix::sparse_matrix(int width, int height) : width(width), height(height)
-{ }
+template <typename V, typename I>
+basic_sparse_matrix<V, I>::basic_sparse_matrix(I width, I height)
+		: dir(column_wise), width(width), height(height), symmetric(false)
+{ init(); }
 
-sparse_matrix::sparse_matrix() : width(0), height(0)
-{ }
+template <typename V, typename I>
+basic_sparse_matrix<V, I>::basic_sparse_matrix() : dir(column_wise), width(0), height(0), symmetric(false)
+{ init(); }
 
-sparse_matrix::~sparse_matrix()
+template <typename V, typename I>
+basic_sparse_matrix<V, I>::~basic_sparse_matrix()
 { }
 
-void sparse_matrix::init()
+template <typename V, typename I>
+void basic_sparse_matrix<V, I>::init()
 {
-	int w_size = dir == column_wise ? width : height;
-	int h_size = dir == column_wise ? height : width;
-	data.clear();
-	data.resize(w_size);
-	for (int i = 0; i < w_size; i++) data[i].reset(h_size, dir);
+	ptr.assign(majorSize() + 1, 0);
+	idx.clear();
+	values.clear();
 }
 
-sparse_matrix sparse_matrix::identity(int size, direction dir)
+template <typename V, typename I>
+I basic_sparse_matrix<V, I>::majorSize() const
+{ return dir == column_wise ? width : height; }
+
+template <typename V, typename I>
+I basic_sparse_matrix<V, I>::minorSize() const
+{ return dir == column_wise ? height : width; }
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::identity(I size, direction dir)
 {
-	vector<sparse_matrix_elem> elements;
-	for(int i=0; i<size; i++)
-		elements.push_back(sparse_matrix_elem{i, i, 1});
+	vector<elem_type> elements;
+	for(I i=0; i<size; i++)
+		elements.push_back(elem_type{i, i, 1});
 
-	return sparse_matrix(elements, size, size, dir);
+	return basic_sparse_matrix(elements, size, size, dir);
 }
 
-void sparse_matrix::resize(int w, int h)
+// Sorts elements along dir and rebuilds compressed storage from them. Zeros
+// are dropped, duplicates are summed or the last one wins (like set does).
+// Symmetric matrices mirror elements above the diagonal to the lower triangle.
+// Sorting is a radix sort with two counting passes - by minor position and
+// then, stable, by major one - so it takes O(nnz + width + height).
+template <typename V, typename I>
+void basic_sparse_matrix<V, I>::compress(vector<elem_type> &elements, bool sum_duplicates)
 {
-	width = w;
-	height = h;
-	int w_size = dir == column_wise ? width : height;
-	int h_size = dir == column_wise ? height : width;
-	data.resize(w_size);
-	for (int i = 0; i < w_size; i++)
-		data[i].reset(h_size, dir);
+	bool by_cols = dir == column_wise;
+	auto major = [by_cols](const elem_type &e) { return by_cols ? e.col : e.row; };
+	auto minor = [by_cols](const elem_type &e) { return by_cols ? e.row : e.col; };
+
+	for (size_t k = 0; k < elements.size(); k++)
+	{
+		if (elements[k].col < 0 || elements[k].col >= width ||
+			elements[k].row < 0 || elements[k].row >= height)
+			throw std::runtime_error("element out of matrix bounds");
+		if (symmetric && elements[k].row < elements[k].col)
+			std::swap(elements[k].row, elements[k].col);
+	}
+
+	arena_scope scope;
+	scratch_vector<elem_type> sorted(elements.size(), elem_type(), scope);
+	scratch_vector<offset_type> start(std::max(majorSize(), minorSize()) + 1, 0, scope);
+
+	std::fill(start.begin(), start.end(), 0);
+	for (size_t k = 0; k < elements.size(); k++)
+		start[minor(elements[k]) + 1]++;
+	for (I i = 0; i < minorSize(); i++)
+		start[i + 1] += start[i];
+	for (size_t k = 0; k < elements.size(); k++)
+		sorted[start[minor(elements[k])]++] = elements[k];
+
+	std::fill(start.begin(), start.end(), 0);
+	for (size_t k = 0; k < sorted.size(); k++)
+		start[major(sorted[k]) + 1]++;
+	for (I i = 0; i < majorSize(); i++)
+		start[i + 1] += start[i];
+	for (size_t k = 0; k < sorted.size(); k++)
+		elements[start[major(sorted[k])]++] = sorted[k];
+
+	init();
+	idx.reserve(elements.size());
+	values.reserve(elements.size());
+	for (size_t k = 0; k < elements.size(); k++)
+	{
+		V value = elements[k].value;
+		while (k + 1 < elements.size() &&
+			   major(elements[k + 1]) == major(elements[k]) &&
+			   minor(elements[k + 1]) == minor(elements[k]))
+		{
+			k++;
+			value = sum_duplicates ? value + elements[k].value : elements[k].value;
+		}
+		if (value == 0) continue;
+		idx.push_back(minor(elements[k]));
+		values.push_back(value);
+		ptr[major(elements[k]) + 1]++;
+	}
+	for (I i = 0; i < majorSize(); i++)
+		ptr[i + 1] += ptr[i];
 }
 
-void sparse_matrix::toggleDir()
+// Builds matrix from coordinate triples summing duplicated positions. The
+// matrix grows to fit all elements, so width and height can be left 0.
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::fromElements(vector<elem_type> elements, I width, I height, direction d)
 {
-	auto raw_data = getRawData();
-	std::swap(width, height);
-	if (dir == column_wise)
+	for (size_t k = 0; k < elements.size(); k++)
 	{
-		dir = row_wise;
-		init();
-		createMatrixByRows(raw_data);
+		if (elements[k].col >= width) width = elements[k].col + 1;
+		if (elements[k].row >= height) height = elements[k].row + 1;
 	}
-	else
+	basic_sparse_matrix result(width, height, d);
+	result.compress(elements, true);
+	return result;
+}
+
+// Drops items outside the new sizes straight from compressed arrays
+template <typename V, typename I>
+void basic_sparse_matrix<V, I>::resize(I w, I h)
+{
+	if (symmetric) *this = toGeneral();
+	I old_major = majorSize();
+	width = w;
+	height = h;
+
+	offset_type n = 0;
+	vector<offset_type> new_ptr(majorSize() + 1, 0);
+	for (I i = 0; i < majorSize(); i++)
 	{
-		dir = column_wise;
-		init();
-		createMatrixByCols(raw_data);
+		if (i < old_major)
+			for (offset_type k = ptr[i]; k < ptr[i + 1] && idx[k] < minorSize(); k++)
+			{
+				idx[n] = idx[k];
+				values[n] = values[k];
+				n++;
+			}
+		new_ptr[i + 1] = n;
 	}
+	ptr.swap(new_ptr);
+	idx.resize(n);
+	values.resize(n);
 }
 
-void sparse_matrix::transpose()
+// Compresses the same items along the other dimension with a counting sort
+// over minor positions. Vectors are visited in order, so positions in new
+// vectors come out sorted without any further sorting. With more threads
+// every thread scatters its block of vectors (bounds from partition) at
+// offsets prefix-summed from its own counts, so no two threads share a slot.
+template <typename V, typename I>
+static void recompress(I n_major, I n_minor, const vector<I> &bounds,
+					   const vector<sparse_offset> &ptr, const vector<I> &idx, const vector<V> &values,
+					   vector<sparse_offset> &t_ptr, vector<I> &t_idx, vector<V> &t_values)
 {
-	if(width != height)
-		throw new std::runtime_error(
-				"Dimensions of matrix must match when transposing!");
+	int threads = bounds.size() - 1;
+	t_ptr.assign(n_minor + 1, 0);
+	t_idx.resize(ptr[n_major]);
+	t_values.resize(ptr[n_major]);
 
-	auto raw_data = getRawData();
+	// next[t * n_minor + j] - where thread t puts its next item of vector j
+	arena_scope scope;
+	scratch_vector<sparse_offset> next((size_t)threads * n_minor, 0, scope);
 
-	// transpose data
-	for(auto it = raw_data.begin(); it != raw_data.end(); it++)
-		*it = sparse_matrix_elem{it->row, it->col, it->value};
+	#pragma omp parallel num_threads(threads) if(threads > 1)
+	{
+		#pragma omp for schedule(static, 1)
+		for (int t = 0; t < threads; t++)
+		{
+			sparse_offset *count = next.data() + (size_t)t * n_minor;
+			for (sparse_offset k = ptr[bounds[t]]; k < ptr[bounds[t + 1]]; k++)
+				count[idx[k]]++;
+		}
 
-	init();
-	if (dir == column_wise)
-		createMatrixByCols(raw_data);
-	else
-		createMatrixByRows(raw_data);
+		#pragma omp for schedule(static)
+		for (I j = 0; j < n_minor; j++)
+			for (int t = 0; t < threads; t++)
+				t_ptr[j + 1] += next[(size_t)t * n_minor + j];
+
+		#pragma omp single
+		for (I j = 0; j < n_minor; j++)
+			t_ptr[j + 1] += t_ptr[j];
+
+		#pragma omp for schedule(static)
+		for (I j = 0; j < n_minor; j++)
+		{
+			sparse_offset offset = t_ptr[j];
+			for (int t = 0; t < threads; t++)
+			{
+				sparse_offset count = next[(size_t)t * n_minor + j];
+				next[(size_t)t * n_minor + j] = offset;
+				offset += count;
+			}
+		}
+
+		#pragma omp for schedule(static, 1)
+		for (int t = 0; t < threads; t++)
+		{
+			sparse_offset *pos = next.data() + (size_t)t * n_minor;
+			for (I i = bounds[t]; i < bounds[t + 1]; i++)
+				for (sparse_offset k = ptr[i]; k < ptr[i + 1]; k++)
+				{
+					sparse_offset p = pos[idx[k]]++;
+					t_idx[p] = i;
+					t_values[p] = values[k];
+				}
+		}
+	}
 }
 
-void sparse_matrix::createMatrixByRows(vector<sparse_matrix_elem> elements)
+template <typename V, typename I>
+void basic_sparse_matrix<V, I>::toggleDir(int threads)
 {
-	for (auto it = elements.begin(); it != elements.end(); it++)
-	{
-		auto elem = *it;
-		if (height < elem.row + 1) resize(width, elem.row + 1);
-		if (width < elem.col + 1) resize(elem.col + 1, height);
-		data[elem.row].set(elem.col, elem.value);
-	}
+	vector<offset_type> t_ptr;
+	vector<I> t_idx;
+	vector<V> t_values;
+	recompress(majorSize(), minorSize(), partition(threads > 1 ? threads : 1),
+			   ptr, idx, values, t_ptr, t_idx, t_values);
+	dir = dir == column_wise ? row_wise : column_wise;
+	ptr.swap(t_ptr);
+	idx.swap(t_idx);
+	values.swap(t_values);
 }
 
-void sparse_matrix::createMatrixByCols(vector<sparse_matrix_elem> elements)
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::toDir(direction d, int threads) const
 {
-	for (auto it = elements.begin(); it != elements.end(); it++)
-	{
-		auto elem = *it;
-		if (width < elem.col + 1) resize(elem.col + 1, height);
-		if (height < elem.row + 1) resize(width, elem.row + 1);
-		data[elem.col].set(elem.row, elem.value);
-	}
+	if (d == dir) return *this;
+	basic_sparse_matrix result(width, height, d);
+	result.symmetric = symmetric;
+	recompress(majorSize(), minorSize(), partition(threads > 1 ? threads : 1),
+			   ptr, idx, values, result.ptr, result.idx, result.values);
+	return result;
+}
+
+// Compressed storage of a matrix along dir is the storage of its transposition
+// along the other direction - so swapping dimensions and direction transposes
+// the matrix for free and toggling brings the direction back.
+template <typename V, typename I>
+void basic_sparse_matrix<V, I>::transpose(int threads)
+{
+	if (symmetric) return;
+	std::swap(width, height);
+	dir = dir == column_wise ? row_wise : column_wise;
+	toggleDir(threads);
 }
 
-vector<sparse_matrix_elem> readSparseElements(const char *name, int offset)
+template <typename V, typename I>
+vector<basic_sparse_matrix_elem<V, I>> readSparseElements(const char *name, int offset)
 {
-	vector<sparse_matrix_elem> elements;
+	vector<basic_sparse_matrix_elem<V, I>> elements;
 	string line;
 	ifstream infile(name);
 
 	while (getline(infile, line) && !line.empty())
 	{
 		istringstream iss(line);
-		int col, row;
-		double val;
+		I col, row;
+		V val;
 		if (!(iss >> col >> row >> val))
 		{
 			throw std::runtime_error(string("Error while reading file: ") + name);
 		}
-		elements.push_back(sparse_matrix_elem{col-offset, row-offset, val});
+		elements.push_back(basic_sparse_matrix_elem<V, I>{col-offset, row-offset, val});
 	}
 	return elements;
 }
 
-vector<sparse_matrix_elem> readDenseElements(const char *name, int &w, int &h)
+template <typename V, typename I>
+vector<basic_sparse_matrix_elem<V, I>> readDenseElements(const char *name, I &w, I &h)
 {
-	vector<sparse_matrix_elem> elements;
+	vector<basic_sparse_matrix_elem<V, I>> elements;
 	string line;
 	ifstream file(name);
-	int i = 0, j = 0;
+	I i = 0, j = 0;
 	while( getline(file, line) )
 	{
 		std::istringstream stream(line);
-		double value;
+		V value;
 		while(stream >> value)
 		{
-			elements.push_back(sparse_matrix_elem{j, i, value});
+			elements.push_back(basic_sparse_matrix_elem<V, I>{j, i, value});
 			j++;
 		}
 		i++;
@@ -167,163 +388,535 @@ vector<sparse_matrix_elem> readDenseElements(const char *name, int &w, int &h)
 	return elements;
 }
 
-sparse_matrix sparse_matrix::fromSparseFile(const char *name, direction d, int offset)
+// Symmetric files may give either triangle, or both as mirror images of
+// each other - a mirrored position is then stored once, not summed.
+// block_matrix::fromSparseFile loads in blocks of the detected size.
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::fromSparseFile(const char *name, direction d, int offset, bool symmetric)
 {
-	auto elements = readSparseElements(name, offset);
-	return sparse_matrix(elements, 0, 0, d);
+	auto elements = readSparseElements<V, I>(name, offset);
+	if (!symmetric) return fromElements(std::move(elements), 0, 0, d);
+
+	I size = 0;
+	for (size_t k = 0; k < elements.size(); k++)
+		size = std::max(size, std::max(elements[k].col, elements[k].row) + 1);
+	basic_sparse_matrix result(size, size, d);
+	result.symmetric = true;
+	result.compress(elements, false);
+	return result;
 }
 
-sparse_matrix sparse_matrix::fromDenseFile(const char *name, direction d)
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::fromDenseFile(const char *name, direction d)
 {
-	int width, height;
-	auto elements = readDenseElements(name, width, height);
-	return sparse_matrix(elements, width, height, d);
+	I width, height;
+	auto elements = readDenseElements<V, I>(name, width, height);
+	return basic_sparse_matrix(elements, width, height, d);
 }
 
-void sparse_matrix::printSparse() const
+template <typename V, typename I>
+void basic_sparse_matrix<V, I>::printSparse() const
 {
 	auto raw_data = getRawData();
 	printf("col\trow\tvalue\n");
 	for (auto it = raw_data.cbegin(); it != raw_data.cend(); it++)
 	{
-		printf("%d\t%d\t%f\n", it->col, it->row, it->value);
+		printf("%lld\t%lld\t%f\n", (long long)it->col, (long long)it->row, (double)it->value);
 	}
 	printf("\n");
 	printf("\n");
 }
 
-void sparse_matrix::printDense() const
+template <typename V, typename I>
+void basic_sparse_matrix<V, I>::printDense() const
 {
-	for(int i=0; i < width; i++)
+	for(I i=0; i < height; i++)
 	{
-		for (int j = 0; j < height; j++)
-			printf("%2.3f ", data[j].get(i));
+		for (I j = 0; j < width; j++)
+			printf("%2.3f ", (double)(dir == column_wise ? get(j, i) : get(i, j)));
 		std::cout << std::endl;
 	}
 	std::cout << std::endl;
 }
 
-vector<pair<sparse_matrix, int>> sparse_matrix::splitToN(int N) const
+template <typename V, typename I>
+vector<pair<basic_sparse_matrix<V, I>, I>> basic_sparse_matrix<V, I>::splitToN(int N) const
 {
-	int size = dir == column_wise ? width : height;
-
-	vector<pair<sparse_matrix, int>> result;
-	vector<sparse_matrix_elem> elements;
+	I size = majorSize();
+	vector<I> bounds = splitBounds(N);
 
-	int len = size / N;
-	int split_size = 0;
-	int new_width = width, new_height = height;
+	vector<pair<basic_sparse_matrix, I>> result;
 
-	for (int i = 1, j = 0, n = 1; i <= size; i++)
+	for (int n = 0; n < N; n++)
 	{
-		if (j < len || n == N)
-		{
-			auto tmp = data[i - 1].getElements(dir, i - 1);
-			elements.insert(elements.end(), tmp.begin(), tmp.end());
-			j++;
-			split_size++;
-		}
-		else
-		{
-			result.push_back(make_pair(sparse_matrix(elements, new_width, new_height, dir), split_size));
-			split_size = 0;
-			elements.clear();
-			j=0;
-			n++;
-			i--;
-		}
+		I begin = bounds[n], end = bounds[n + 1];
+
+		// Every part keeps dimensions of the whole matrix
+		vector<offset_type> part_ptr(size + 1, 0);
+		for (I i = begin; i < size; i++)
+			part_ptr[i + 1] = ptr[i < end ? i + 1 : end] - ptr[begin];
+
+		vector<I> part_idx(idx.begin() + ptr[begin], idx.begin() + ptr[end]);
+		vector<V> part_values(values.begin() + ptr[begin], values.begin() + ptr[end]);
+
+		result.push_back(make_pair(
+				basic_sparse_matrix(width, height, dir, part_ptr, part_idx, part_values, symmetric),
+				end - begin));
 	}
 
-	result.push_back(make_pair(sparse_matrix(elements, new_width, new_height, dir), split_size));
 	return result;
 }
 
-vector<sparse_matrix_elem> sparse_matrix::getRawData() const
+// N blocks of size / N vectors, the last one taking the rest
+template <typename V, typename I>
+vector<I> basic_sparse_matrix<V, I>::splitBounds(int N) const
 {
-	std::vector<sparse_matrix_elem> elements;
-	try
+	I size = majorSize();
+	vector<I> bounds(N + 1, 0);
+	for (int n = 1; n < N; n++)
+		bounds[n] = bounds[n - 1] + size / N;
+	bounds[N] = size;
+	return bounds;
+}
+
+// Inverse of splitToN - parts of equal sizes and direction hold disjoint
+// blocks of vectors, which are copied one after another
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::join(const vector<basic_sparse_matrix> &parts)
+{
+	if (parts.empty()) return basic_sparse_matrix();
+	basic_sparse_matrix result(parts[0].width, parts[0].height, parts[0].dir);
+	result.symmetric = parts[0].symmetric;
+	I n = result.majorSize();
+
+	size_t nnz = 0;
+	for (auto it = parts.begin(); it != parts.end(); it++)
 	{
-		for(int i=0; i<data.size(); i++)
+		if (it->width != result.width || it->height != result.height || it->dir != result.dir)
+			throw std::runtime_error("joined parts do not match");
+		nnz += it->getNnz();
+	}
+	result.idx.reserve(nnz);
+	result.values.reserve(nnz);
+
+	for (I i = 0; i < n; i++)
+	{
+		for (auto it = parts.begin(); it != parts.end(); it++)
 		{
-			auto tmp = data[i].getElements(dir, i);
-			if (tmp.size() > 0)
-				elements.insert(elements.end(), tmp.begin(), tmp.end());
+			result.idx.insert(result.idx.end(), it->idx.begin() + it->ptr[i], it->idx.begin() + it->ptr[i + 1]);
+			result.values.insert(result.values.end(), it->values.begin() + it->ptr[i], it->values.begin() + it->ptr[i + 1]);
 		}
+		result.ptr[i + 1] = result.idx.size();
 	}
-	catch(exception e)
+	return result;
+}
+
+// Splits vectors into parts with roughly equal number of nonzeros. Part t
+// holds vectors [result[t], result[t+1]).
+template <typename V, typename I>
+vector<I> basic_sparse_matrix<V, I>::partition(int parts) const
+{
+	I n = majorSize();
+	vector<I> result(parts + 1, n);
+	result[0] = 0;
+	for (int t = 1; t < parts; t++)
 	{
-		printf("getRawData: %s", e.what());
+		offset_type target = (offset_type)getNnz() * t / parts;
+		I i = std::lower_bound(ptr.begin(), ptr.end(), target) - ptr.begin();
+		result[t] = std::max(result[t - 1], std::min(i, n));
 	}
+	return result;
+}
+
+// Symmetric matrices give both triangles
+template <typename V, typename I>
+vector<basic_sparse_matrix_elem<V, I>> basic_sparse_matrix<V, I>::getRawData() const
+{
+	std::vector<elem_type> elements;
+	elements.reserve(symmetric ? 2 * values.size() : values.size());
+	for (I i = 0; i < majorSize(); i++)
+		for (offset_type k = ptr[i]; k < ptr[i + 1]; k++)
+		{
+			if (dir == column_wise)
+				elements.push_back(elem_type{i, idx[k], values[k]});
+			else
+				elements.push_back(elem_type{idx[k], i, values[k]});
+			if (symmetric && idx[k] != i)
+				elements.push_back(elem_type{elements.back().row, elements.back().col, values[k]});
+		}
 	return elements;
 }
 
-int sparse_matrix::getWidth() const
+template <typename V, typename I>
+vector<basic_sparse_vector<V, I>> basic_sparse_matrix<V, I>::getVectors() const
+{
+	if (symmetric) return toGeneral().getVectors();
+
+	vector<vector_type> result;
+	result.reserve(majorSize());
+	for (I i = 0; i < majorSize(); i++)
+		result.push_back((*this)[i]);
+	return result;
+}
+
+// Returns the same value as (*this)[i][j] without building the i-th vector
+template <typename V, typename I>
+V basic_sparse_matrix<V, I>::get(I i, I j) const
+{
+	if (i < 0 || i >= majorSize() || j < 0 || j >= minorSize())
+		throw std::runtime_error("index out of bounds");
+	// Items above the diagonal are read from their mirror image
+	if (symmetric && (dir == column_wise ? j < i : j > i))
+		std::swap(i, j);
+	auto first = idx.begin() + ptr[i];
+	auto last = idx.begin() + ptr[i + 1];
+	auto it = std::lower_bound(first, last, j);
+	if (it != last && *it == j)
+		return values[it - idx.begin()];
+	return 0;
+}
+
+template <typename V, typename I>
+I basic_sparse_matrix<V, I>::getWidth() const
 { return width; }
 
-int sparse_matrix::getHeight() const
+template <typename V, typename I>
+I basic_sparse_matrix<V, I>::getHeight() const
 { return height; }
 
-sparse_matrix sparse_matrix::getL()
+template <typename V, typename I>
+size_t basic_sparse_matrix<V, I>::getNnz() const
+{ return values.size(); }
+
+// Square block sizes tried by detectBlockSize, largest first
+static const int BLOCK_SIZES[] = {6, 4, 3, 2};
+
+// Blocks may hold at most that many stored items per nonzero
+#define BLOCK_MAX_FILL 1.1
+
+// Largest block size b for which cutting the matrix into b x b blocks keeps
+// explicit zeros within BLOCK_MAX_FILL, or 1 when there is no such size.
+// Counts distinct blocks of every group of b vectors, O(nnz) per size.
+template <typename V, typename I>
+int basic_sparse_matrix<V, I>::detectBlockSize() const
+{
+	if (values.empty()) return 1;
+	// Blocks on the diagonal are only half stored in the lower triangle
+	if (symmetric) return toGeneral().detectBlockSize();
+	vector<I> mark;
+	for (int b : BLOCK_SIZES)
+	{
+		mark.assign(minorSize() / b + 1, -1);
+		long long blocks = 0;
+		for (I i = 0; i < majorSize(); i++)
+			for (offset_type k = ptr[i]; k < ptr[i + 1]; k++)
+				if (mark[idx[k] / b] != i / b)
+				{
+					mark[idx[k] / b] = i / b;
+					blocks++;
+				}
+		if (blocks * b * b <= BLOCK_MAX_FILL * values.size()) return b;
+	}
+	return 1;
+}
+
+// Rows take the smallest color none of their neighbours - items of the row
+// and of the column - has taken yet, in natural order. A 5-point mesh gets
+// the red-black coloring. Levels of the triangular factors of a matrix
+// reordered this way are its colors, one per color when there is no fill.
+template <typename V, typename I>
+vector<I> basic_sparse_matrix<V, I>::multicolorOrder(I *colors) const
+{
+	if (width != height)
+		throw std::runtime_error("Only square matrices are colored");
+	if (symmetric) return toGeneral().multicolorOrder(colors);
+
+	basic_sparse_matrix other(toDir(dir == column_wise ? row_wise : column_wise));
+	const basic_sparse_matrix *sides[] = {this, &other};
+
+	arena_scope scope;
+	scratch_vector<I> color(width, -1, scope);
+	// mark[c] == i when a neighbour of row i has color c
+	scratch_vector<I> mark(width, -1, scope);
+	I count = 0;
+	for (I i = 0; i < width; i++)
+	{
+		for (auto side : sides)
+			for (auto k = side->ptr[i]; k < side->ptr[i + 1]; k++)
+			{
+				I j = side->idx[k];
+				if (j != i && color[j] >= 0) mark[color[j]] = i;
+			}
+		I c = 0;
+		while (mark[c] == i) c++;
+		color[i] = c;
+		count = std::max(count, c + 1);
+	}
+
+	vector<I> start(count + 1, 0);
+	for (I i = 0; i < width; i++)
+		start[color[i] + 1]++;
+	for (I c = 0; c < count; c++)
+		start[c + 1] += start[c];
+	vector<I> order(width);
+	for (I i = 0; i < width; i++)
+		order[start[color[i]]++] = i;
+
+	if (colors) *colors = count;
+	return order;
+}
+
+// Vector k of the result is vector order[k] with its indices renumbered and
+// sorted again
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::permuted(const vector<I> &order) const
 {
-	sparse_matrix result(width, height, dir);
-	for(int i=0; i<width; i++)
-		for(int j=i; j<height; j++)
+	if (width != height || (I)order.size() != width)
+		throw std::runtime_error("Permutation does not match the matrix");
+	if (symmetric) return toGeneral().permuted(order);
+
+	arena_scope scope;
+	scratch_vector<I> position(width, 0, scope);
+	for (I k = 0; k < width; k++)
+		position[order[k]] = k;
+
+	basic_sparse_matrix result(width, height, dir);
+	result.idx.reserve(idx.size());
+	result.values.reserve(values.size());
+	scratch_vector<std::pair<I, V>> items(scope);
+	for (I k = 0; k < width; k++)
+	{
+		items.clear();
+		for (auto t = ptr[order[k]]; t < ptr[order[k] + 1]; t++)
+			items.push_back(std::make_pair(position[idx[t]], values[t]));
+		std::sort(items.begin(), items.end());
+		for (auto it = items.begin(); it != items.end(); it++)
 		{
-			if (i==j) result[i][i] = 1.0;
-			else result[i][j] = (*this)[i][j];
+			result.idx.push_back(it->first);
+			result.values.push_back(it->second);
 		}
+		result.ptr[k + 1] = result.idx.size();
+	}
+	return result;
+}
+
+template <typename V, typename I>
+const vector<sparse_offset> &basic_sparse_matrix<V, I>::getPtr() const
+{ return ptr; }
+
+template <typename V, typename I>
+const vector<I> &basic_sparse_matrix<V, I>::getIdx() const
+{ return idx; }
+
+template <typename V, typename I>
+const vector<V> &basic_sparse_matrix<V, I>::getValues() const
+{ return values; }
+
+// Strictly lower triangle with ones on the diagonal, filtered vector by
+// vector - below the diagonal is after position i in column i and before
+// it in row i
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::getL() const
+{
+	if (symmetric) return toGeneral().getL();
+	basic_sparse_matrix result(width, height, dir);
+	for (I i = 0; i < majorSize(); i++)
+	{
+		bool diagonal = i < minorSize();
+		if (dir == column_wise && diagonal)
+		{
+			result.idx.push_back(i);
+			result.values.push_back(1.0);
+		}
+		for (offset_type k = ptr[i]; k < ptr[i + 1]; k++)
+			if (dir == column_wise ? idx[k] > i : idx[k] < i)
+			{
+				result.idx.push_back(idx[k]);
+				result.values.push_back(values[k]);
+			}
+		if (dir == row_wise && diagonal)
+		{
+			result.idx.push_back(i);
+			result.values.push_back(1.0);
+		}
+		result.ptr[i + 1] = result.idx.size();
+	}
 	result.clean();
 	return result;
 }
 
-sparse_matrix sparse_matrix::getU()
+// Upper triangle with the diagonal, filtered vector by vector
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::getU() const
 {
-	sparse_matrix result(width, height, dir);
-	for(int i=0; i<width; i++)
-		for(int j=0; j<=i; j++)
-			result[i][j] = (*this)[i][j];
+	if (symmetric) return toGeneral().getU();
+	basic_sparse_matrix result(width, height, dir);
+	for (I i = 0; i < majorSize(); i++)
+	{
+		for (offset_type k = ptr[i]; k < ptr[i + 1]; k++)
+			if (dir == column_wise ? idx[k] <= i : idx[k] >= i)
+			{
+				result.idx.push_back(idx[k]);
+				result.values.push_back(values[k]);
+			}
+		result.ptr[i + 1] = result.idx.size();
+	}
 	result.clean();
 	return result;
 }
 
-void sparse_matrix::clean()
+template <typename V, typename I>
+void basic_sparse_matrix<V, I>::clean()
 {
-	for(int i=0; i<width; i++)
-		data[i].clean();
+	offset_type n = 0;
+	for (I i = 0; i < majorSize(); i++)
+	{
+		offset_type begin = ptr[i];
+		ptr[i] = n;
+		for (offset_type k = begin; k < ptr[i + 1]; k++)
+		{
+			if (fabs(values[k]) < 1e-6) continue;
+			idx[n] = idx[k];
+			values[n] = values[k];
+			n++;
+		}
+	}
+	ptr[majorSize()] = n;
+	idx.resize(n);
+	values.resize(n);
 }
 
-direction sparse_matrix::getDir() const
+template <typename V, typename I>
+direction basic_sparse_matrix<V, I>::getDir() const
 {
 	return dir;
 }
 
-sparse_vector sparse_matrix::getRow(int n)
+template <typename V, typename I>
+bool basic_sparse_matrix<V, I>::isSymmetric() const
+{
+	return symmetric;
+}
+
+// Keeps only the lower triangle, which describes the whole matrix as long
+// as it is symmetric
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::toSymmetric() const
 {
-	if (dir == row_wise) return data[n];
+	if (width != height)
+		throw std::runtime_error("symmetric matrix has to be square");
+	basic_sparse_matrix result(*this);
+	if (symmetric) return result;
+	result.symmetric = true;
+
+	offset_type n = 0;
+	for (I i = 0; i < majorSize(); i++)
+	{
+		offset_type begin = result.ptr[i];
+		result.ptr[i] = n;
+		for (offset_type k = begin; k < result.ptr[i + 1]; k++)
+		{
+			if (dir == column_wise ? result.idx[k] < i : result.idx[k] > i) continue;
+			result.idx[n] = result.idx[k];
+			result.values[n] = result.values[k];
+			n++;
+		}
+	}
+	result.ptr[majorSize()] = n;
+	result.idx.resize(n);
+	result.values.resize(n);
+	return result;
+}
+
+// Stores both triangles of a symmetric matrix. Mirrored items of vector j
+// sit in vectors i on the other side of the diagonal, which are visited in
+// order - so they come before the stored items of a column (all above the
+// diagonal) or after those of a row, and vectors stay sorted.
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::toGeneral() const &
+{
+	if (!symmetric) return *this;
+	I n = majorSize();
+	arena_scope scope;
+	scratch_vector<offset_type> count(n + 1, 0, scope);
+	for (I i = 0; i < n; i++)
+		for (offset_type k = ptr[i]; k < ptr[i + 1]; k++)
+		{
+			count[i + 1]++;
+			if (idx[k] != i) count[idx[k] + 1]++;
+		}
+	for (I i = 0; i < n; i++)
+		count[i + 1] += count[i];
+
+	vector<offset_type> g_ptr(count.begin(), count.end());
+	vector<I> g_idx(count[n]);
+	vector<V> g_values(count[n]);
+	bool mirrored_first = dir == column_wise;
+
+	// next[j] - where the next mirrored item of vector j goes
+	scratch_vector<offset_type> next(n, 0, scope);
+	for (I j = 0; j < n; j++)
+		next[j] = mirrored_first ? g_ptr[j] : g_ptr[j] + (ptr[j + 1] - ptr[j]);
+	for (I i = 0; i < n; i++)
+	{
+		offset_type mirrored = (g_ptr[i + 1] - g_ptr[i]) - (ptr[i + 1] - ptr[i]);
+		offset_type out = mirrored_first ? g_ptr[i] + mirrored : g_ptr[i];
+		for (offset_type k = ptr[i]; k < ptr[i + 1]; k++, out++)
+		{
+			g_idx[out] = idx[k];
+			g_values[out] = values[k];
+			if (idx[k] == i) continue;
+			offset_type p = next[idx[k]]++;
+			g_idx[p] = i;
+			g_values[p] = values[k];
+		}
+	}
+	return basic_sparse_matrix(width, height, dir, std::move(g_ptr), std::move(g_idx), std::move(g_values));
+}
+
+// A general matrix going away is handed on instead of copied
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::toGeneral() &&
+{
+	if (!symmetric) return std::move(*this);
+	return static_cast<const basic_sparse_matrix &>(*this).toGeneral();
+}
+
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_matrix<V, I>::getRow(I n) const
+{
+	if (dir == row_wise) return (*this)[n];
 	else
 	{
-		sparse_vector result(width, row_wise);
-		for(int i=0; i<width; i++)
-			result.set(i, data[i][n]);
+		vector_type result(width, row_wise);
+		for(I i=0; i<width; i++)
+			result.set(i, get(i, n));
 		return result;
 	}
 }
 
-sparse_vector sparse_matrix::getCol(int n)
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_matrix<V, I>::getCol(I n) const
 {
-	if (dir == column_wise) return data[n];
+	if (dir == column_wise) return (*this)[n];
 	else
 	{
-		sparse_vector result(height, column_wise);
-		for(int i=0; i<height; i++)
-			result.set(i, data[n][i]);
+		vector_type result(height, column_wise);
+		for(I i=0; i<height; i++)
+			result.set(i, get(i, n));
 		return result;
 	}
 }
 
-void sparse_matrix::fill(vector<sparse_matrix_elem> elements)
+template <typename V, typename I>
+void basic_sparse_matrix<V, I>::fill(vector<elem_type> elements)
 {
-	init();
-	if (dir == column_wise) createMatrixByCols(elements);
-	else if (dir == row_wise) createMatrixByRows(elements);
-}
\ No newline at end of file
+	for (auto it = elements.begin(); it != elements.end(); it++)
+	{
+		if (width < it->col + 1) width = it->col + 1;
+		if (height < it->row + 1) height = it->row + 1;
+	}
+	compress(elements, false);
+}
+
+INSTANTIATE_SPARSE(basic_sparse_matrix)
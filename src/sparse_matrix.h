@@ -7,72 +7,192 @@
 #define __sparse_matrix_H_
 
 #include <cstdlib>
+#include <cstdint>
 #include <tuple>
 #include <vector>
 #include <array>
 #include "sparse_matrix_elem.h"
 #include "direction.h"
 #include "sparse_vector.h"
+#include "dense_vector.h"
 
 using namespace std;
 
-class sparse_matrix
+template <typename V, typename I> class basic_transposed_matrix;
+
+// Offsets into compressed arrays - 64 bit whatever positions are, so the
+// number of nonzeros is not bounded by the range of positions
+typedef int64_t sparse_offset;
+
+// Matrix of values V at positions of type I
+template <typename V, typename I>
+class basic_sparse_matrix
 {
+	friend class basic_transposed_matrix<V, I>;
+
+// TYPES
+public:
+	typedef V value_type;
+	typedef I index_type;
+	typedef sparse_offset offset_type;
+	typedef basic_sparse_matrix_elem<V, I> elem_type;
+	typedef basic_sparse_vector<V, I> vector_type;
+	typedef basic_transposed_matrix<V, I> transposed_type;
+
 // FIELDS
 private:
-	vector<sparse_vector> data;
 	direction dir;
-	int width;
-	int height;
+	I width;
+	I height;
+
+	// Symmetric matrices keep only their lower triangle (row >= col)
+	bool symmetric;
+
+	// Compressed storage along dir - CSC when column_wise, CSR when row_wise.
+	// Vector i (column or row) keeps its positions in idx[ptr[i]..ptr[i+1])
+	// sorted ascending, with matching values in values[ptr[i]..ptr[i+1]).
+	vector<offset_type> ptr;
+	vector<I> idx;
+	vector<V> values;
 
 // CONSTRUCTORS
 public:
-	sparse_matrix();
-	sparse_matrix(int width, int height);
-	sparse_matrix(int width, int height, direction d);
-	sparse_matrix(vector<sparse_matrix_elem> elements, int width, int height, direction d);
-	~sparse_matrix();
-	sparse_matrix(const sparse_matrix &m);
+	basic_sparse_matrix();
+	basic_sparse_matrix(I width, I height);
+	basic_sparse_matrix(I width, I height, direction d);
+	basic_sparse_matrix(vector<elem_type> elements, I width, I height, direction d);
+	basic_sparse_matrix(const vector<vector_type> &vectors, I width, I height, direction d);
+	basic_sparse_matrix(I width, I height, direction d,
+						vector<offset_type> ptr, vector<I> idx, vector<V> values, bool symmetric = false);
+	~basic_sparse_matrix();
+	basic_sparse_matrix(const basic_sparse_matrix &m);
+	// Takes over arrays of m, leaving it an empty matrix
+	basic_sparse_matrix(basic_sparse_matrix &&m);
+	basic_sparse_matrix &operator=(const basic_sparse_matrix &m);
+	basic_sparse_matrix &operator=(basic_sparse_matrix &&m);
 
-	static sparse_matrix identity(int size, direction dir = column_wise);
+	static basic_sparse_matrix identity(I size, direction dir = column_wise);
 
 // OPERATORS
 public:
-	sparse_matrix operator+(const sparse_matrix &m) const;
-	sparse_matrix& operator+=(const sparse_matrix &m);
-	sparse_matrix operator-(const sparse_matrix &m) const;
-	sparse_matrix& operator-=(const sparse_matrix &m);
-	sparse_matrix operator*(const sparse_matrix &m) const;
-	sparse_vector operator*(const sparse_vector &v) const;
-
-	sparse_vector & operator[](size_t el);
-	const sparse_vector & operator[](size_t el) const;
-	bool operator==(const sparse_matrix &m);
-	bool operator!=(const sparse_matrix &m);
+	basic_sparse_matrix operator+(const basic_sparse_matrix &m) const;
+	basic_sparse_matrix& operator+=(const basic_sparse_matrix &m);
+	basic_sparse_matrix operator-(const basic_sparse_matrix &m) const;
+	basic_sparse_matrix& operator-=(const basic_sparse_matrix &m);
+	basic_sparse_matrix operator*(const basic_sparse_matrix &m) const;
+	basic_sparse_matrix operator*(const transposed_type &m) const;
+	vector_type operator*(const vector_type &v) const;
+	dense_vector operator*(const dense_vector &v) const;
+
+	vector_type operator[](size_t el) const;
+	bool operator==(const basic_sparse_matrix &m);
+	bool operator!=(const basic_sparse_matrix &m);
 
 // METHODS
 public:
-	void fill(vector<sparse_matrix_elem> elements);
-	void resize(int w, int h);
-	void toggleDir();
-	void transpose();
+	void fill(vector<elem_type> elements);
+	void resize(I w, I h);
+	void toggleDir(int threads = 1);
+	// Copy compressed along d, recompressed straight from this one
+	basic_sparse_matrix toDir(direction d, int threads = 1) const;
+	void transpose(int threads = 1);
+	transposed_type transposed() const;
 	void init();
 	void clean();
 	void printSparse() const;
 	void printDense() const;
-	void createMatrixByRows(vector<sparse_matrix_elem> elements);
-	void createMatrixByCols(vector<sparse_matrix_elem> elements);
-	vector<std::pair<sparse_matrix, int>> splitToN(int N) const;
-	static sparse_matrix fromSparseFile(const char *name, direction d, int offset = 0);
-	static sparse_matrix fromDenseFile(const char *name, direction d);
-	vector<sparse_matrix_elem> getRawData() const;
-	int getWidth() const;
-	int getHeight() const;
+	vector<std::pair<basic_sparse_matrix, I>> splitToN(int N) const;
+	// Bounds of the blocks of vectors splitToN cuts the matrix into
+	vector<I> splitBounds(int N) const;
+	static basic_sparse_matrix join(const vector<basic_sparse_matrix> &parts);
+	basic_sparse_matrix multiply(const basic_sparse_matrix &m, int threads) const;
+	basic_sparse_matrix multiply(const transposed_type &m, int threads) const;
+	vector_type multiply(const vector_type &v, int threads) const;
+	// Values are accumulated in double whatever V is
+	dense_vector multiply(const dense_vector &v, int threads) const;
+	static basic_sparse_matrix fromElements(vector<elem_type> elements, I width, I height, direction d);
+	static basic_sparse_matrix fromSparseFile(const char *name, direction d, int offset = 0, bool symmetric = false);
+	static basic_sparse_matrix fromDenseFile(const char *name, direction d);
+	// Coordinate copy of the whole matrix - code paths meant for large
+	// matrices work on compressed arrays instead
+	vector<elem_type> getRawData() const;
+	vector<vector_type> getVectors() const;
+	V get(I i, I j) const;
+	I getWidth() const;
+	I getHeight() const;
+	size_t getNnz() const;
+	int detectBlockSize() const;
+	// Order of rows of a square matrix grouped by colors of a greedy
+	// coloring - rows of one color are not coupled either way. The number
+	// of colors goes to colors when given.
+	vector<I> multicolorOrder(I *colors = nullptr) const;
+	// P * A * P^T - row and column order[k] of this one become k
+	basic_sparse_matrix permuted(const vector<I> &order) const;
 	direction getDir() const;
-	sparse_matrix getL();
-	sparse_matrix getU();
-	sparse_vector getRow(int n);
-	sparse_vector getCol(int n);
+	bool isSymmetric() const;
+	const vector<offset_type> &getPtr() const;
+	const vector<I> &getIdx() const;
+	const vector<V> &getValues() const;
+	basic_sparse_matrix toSymmetric() const;
+	basic_sparse_matrix toGeneral() const &;
+	basic_sparse_matrix toGeneral() &&;
+	basic_sparse_matrix getL() const;
+	basic_sparse_matrix getU() const;
+	vector_type getRow(I n) const;
+	vector_type getCol(I n) const;
+
+	// Same matrix with values and positions converted to other types
+	template <typename V2, typename I2>
+	basic_sparse_matrix<V2, I2> convert() const;
+
+private:
+	I majorSize() const;
+	I minorSize() const;
+	vector<I> partition(int parts) const;
+	basic_sparse_matrix merge(const basic_sparse_matrix &m, double factor) const;
+	void compress(vector<elem_type> &elements, bool sum_duplicates);
 };
 
-#endif //__sparse_matrix_H_
\ No newline at end of file
+// Non-owning view of the transposition of a matrix, which has to outlive it.
+// Products run on the arrays of the matrix, read along the other direction,
+// so the transposition is never built.
+template <typename V, typename I>
+class basic_transposed_matrix
+{
+public:
+	typedef basic_sparse_matrix<V, I> matrix_type;
+	typedef basic_sparse_vector<V, I> vector_type;
+
+private:
+	const matrix_type *m;
+
+public:
+	explicit basic_transposed_matrix(const matrix_type &m);
+
+	matrix_type operator*(const matrix_type &other) const;
+	vector_type operator*(const vector_type &v) const;
+	dense_vector operator*(const dense_vector &v) const;
+
+	matrix_type multiply(const matrix_type &other, int threads) const;
+	vector_type multiply(const vector_type &v, int threads) const;
+	dense_vector multiply(const dense_vector &v, int threads) const;
+	const matrix_type &matrix() const;
+	I getWidth() const;
+	I getHeight() const;
+	direction getDir() const;
+};
+
+template <typename V, typename I>
+template <typename V2, typename I2>
+basic_sparse_matrix<V2, I2> basic_sparse_matrix<V, I>::convert() const
+{
+	return basic_sparse_matrix<V2, I2>(width, height, dir,
+			ptr, vector<I2>(idx.begin(), idx.end()),
+			vector<V2>(values.begin(), values.end()), symmetric);
+}
+
+// Double values at int positions, what the MPI helper and solvers work on
+typedef basic_sparse_matrix<double, int> sparse_matrix;
+typedef basic_transposed_matrix<double, int> transposed_matrix;
+
+#endif //__sparse_matrix_H_
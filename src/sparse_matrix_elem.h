@@ -5,11 +5,23 @@
 #ifndef MPI_MATRICES_SPARSE_ELEM_H
 #define MPI_MATRICES_SPARSE_ELEM_H
 
-struct sparse_matrix_elem
+#include <stdint.h>
+
+template <typename V, typename I>
+struct basic_sparse_matrix_elem
 {
-	int col;
-	int row;
-	double value;
+	I col;
+	I row;
+	V value;
 };
 
+typedef basic_sparse_matrix_elem<double, int> sparse_matrix_elem;
+
+// Sparse storage classes are compiled for these value and index types
+#define INSTANTIATE_SPARSE(NAME) \
+	template class NAME<double, int32_t>; \
+	template class NAME<float, int32_t>; \
+	template class NAME<double, int64_t>; \
+	template class NAME<float, int64_t>;
+
 #endif //MPI_MATRICES_SPARSE_ELEM_H
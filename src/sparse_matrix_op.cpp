@@ -3,94 +3,576 @@
 //
 
 #include <stdio.h>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
 #include "sparse_matrix.h"
+#include "sparse_kernels.h"
+#include "arena.h"
 
-sparse_matrix sparse_matrix::operator+(const sparse_matrix &m) const
+// Returns this + factor * m merging matching vectors of both matrices. The
+// result takes the larger of both sizes, missing vectors count as empty.
+// Lower triangles of two symmetric matrices merge into a symmetric result.
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::merge(const basic_sparse_matrix &m, double factor) const
 {
-    if(dir != m.getDir()) throw new std::runtime_error("adding matrices with different directions");
-    int w = width > m.getWidth() ? width : m.getWidth();
-    int h = height > m.getHeight() ? height : m.getHeight();
-    sparse_matrix result(w, h, dir);
-    for(int i=0; i<data.size(); i++)
-        result[i] = data[i] + m[i];
+    if (symmetric != m.symmetric)
+        return toGeneral().merge(m.toGeneral(), factor);
+
+    I w = width > m.getWidth() ? width : m.getWidth();
+    I h = height > m.getHeight() ? height : m.getHeight();
+    basic_sparse_matrix result(w, h, dir);
+    result.symmetric = symmetric;
+    I n = result.majorSize();
+
+    result.idx.reserve(values.size() + m.values.size());
+    result.values.reserve(values.size() + m.values.size());
+    for (I j = 0; j < n; j++)
+    {
+        offset_type x_begin = j < majorSize() ? ptr[j] : 0, x_end = j < majorSize() ? ptr[j + 1] : 0;
+        offset_type y_begin = j < m.majorSize() ? m.ptr[j] : 0, y_end = j < m.majorSize() ? m.ptr[j + 1] : 0;
+        sparse_axpy<V, I>(idx.data() + x_begin, values.data() + x_begin, x_end - x_begin,
+                    factor, m.idx.data() + y_begin, m.values.data() + y_begin, y_end - y_begin,
+                    result.idx, result.values);
+        result.ptr[j + 1] = result.idx.size();
+    }
     return result;
 }
 
-sparse_matrix sparse_matrix::operator-(const sparse_matrix &m) const
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::operator+(const basic_sparse_matrix &m) const
 {
     if(dir != m.getDir()) throw new std::runtime_error("adding matrices with different directions");
-    int w = width > m.getWidth() ? width : m.getWidth();
-    int h = height > m.getHeight() ? height : m.getHeight();
-    sparse_matrix result(w, h, dir);
-    for(int i=0; i<data.size(); i++)
-        result[i] = data[i] - m[i];
-    return result;
+    return merge(m, 1.0);
 }
 
-sparse_matrix sparse_matrix::operator*(const sparse_matrix &m) const
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::operator-(const basic_sparse_matrix &m) const
 {
-    sparse_matrix result(m.width, height, dir);
+    if(dir != m.getDir()) throw new std::runtime_error("adding matrices with different directions");
+    return merge(m, -1.0);
+}
+
+// Output vectors handed out to a thread at a time - small enough for dynamic
+// scheduling to even out vectors of very different cost
+#define SPGEMM_CHUNK 64
 
-    for (int i = 0; i < data.size(); i++)
+// Gustavson's product on compressed arrays: result vector j is the sum of
+// vectors k of x scaled by items (k, y_kj) of vector j of y. A symbolic pass
+// sizes the output exactly, then a dense accumulator over the minor dimension
+// collects every result vector, dropping values that cancel out to zero.
+// With threads > 1 result vectors are scheduled dynamically, every thread
+// having its own accumulator, and prefix sums over per-vector counts place
+// them in the compressed result.
+template <typename V, typename I>
+static void spgemm(I minor, I n,
+                   const vector<sparse_offset> &x_ptr, const vector<I> &x_idx, const vector<V> &x_val,
+                   const vector<sparse_offset> &y_ptr, const vector<I> &y_idx, const vector<V> &y_val,
+                   vector<sparse_offset> &ptr, vector<I> &idx, vector<V> &values, int threads)
+{
+    arena_scope scope;
+    scratch_vector<I> count(n + 1, 0, scope);
+
+    // Symbolic pass - every thread keeps its scratch arrays in its own arena
+    #pragma omp parallel num_threads(threads) if(threads > 1)
     {
-        vector<sparse_matrix_elem> part_result = data[i] * m.data[i];
-        for(vector<sparse_matrix_elem>::iterator it = part_result.begin(); it != part_result.end(); it++)
+        arena_scope thread_scope;
+        scratch_vector<I> mark(minor, -1, thread_scope);
+        #pragma omp for schedule(dynamic, SPGEMM_CHUNK)
+        for (I j = 0; j < n; j++)
         {
-            result[it->col][it->row] += it->value;
+            I c = 0;
+            for (sparse_offset l = y_ptr[j]; l < y_ptr[j + 1]; l++)
+            {
+                I k = y_idx[l];
+                for (sparse_offset t = x_ptr[k]; t < x_ptr[k + 1]; t++)
+                    if (mark[x_idx[t]] != j)
+                    {
+                        mark[x_idx[t]] = j;
+                        c++;
+                    }
+            }
+            count[j] = c;
         }
     }
-//    result.clean();
-    return result;
+
+    ptr.assign(n + 1, 0);
+    for (I j = 0; j < n; j++)
+        ptr[j + 1] = ptr[j] + count[j];
+    idx.resize(ptr[n]);
+    values.resize(ptr[n]);
+
+    // Numeric pass - every vector is written into its own slot, count[j] is
+    // then the number of items left after dropping zeros
+    #pragma omp parallel num_threads(threads) if(threads > 1)
+    {
+        arena_scope thread_scope;
+        scratch_vector<I> mark(minor, -1, thread_scope);
+        scratch_vector<V> acc(minor, 0, thread_scope);
+        #pragma omp for schedule(dynamic, SPGEMM_CHUNK)
+        for (I j = 0; j < n; j++)
+        {
+            sparse_offset begin = ptr[j];
+            I c = 0;
+            for (sparse_offset l = y_ptr[j]; l < y_ptr[j + 1]; l++)
+            {
+                I k = y_idx[l];
+                V y = y_val[l];
+                for (sparse_offset t = x_ptr[k]; t < x_ptr[k + 1]; t++)
+                {
+                    I i = x_idx[t];
+                    if (mark[i] != j)
+                    {
+                        mark[i] = j;
+                        idx[begin + c++] = i;
+                        acc[i] = x_val[t] * y;
+                    }
+                    else acc[i] += x_val[t] * y;
+                }
+            }
+            std::sort(idx.begin() + begin, idx.begin() + begin + c);
+
+            I kept = 0;
+            for (I l = 0; l < c; l++)
+            {
+                I i = idx[begin + l];
+                if (acc[i] == 0) continue;
+                idx[begin + kept] = i;
+                values[begin + kept++] = acc[i];
+            }
+            count[j] = kept;
+        }
+    }
+
+    // Close the gaps left by cancelled values, vectors only move towards
+    // the front so it can be done in place
+    sparse_offset nnz = 0;
+    for (I j = 0; j < n; j++)
+    {
+        sparse_offset begin = ptr[j];
+        ptr[j] = nnz;
+        if (begin != nnz)
+            for (I l = 0; l < count[j]; l++)
+            {
+                idx[nnz + l] = idx[begin + l];
+                values[nnz + l] = values[begin + l];
+            }
+        nnz += count[j];
+    }
+    ptr[n] = nnz;
+    idx.resize(nnz);
+    values.resize(nnz);
 }
 
-sparse_matrix &sparse_matrix::operator+=(const sparse_matrix &m)
+// Compressed arrays read as a matrix of given shape - the arrays of a matrix
+// along dir are also the arrays of its transposition along the other direction
+template <typename V, typename I>
+struct compressed_ref
+{
+    I width;
+    I height;
+    direction dir;
+    const vector<sparse_offset> &ptr;
+    const vector<I> &idx;
+    const vector<V> &values;
+};
+
+static direction other_dir(direction d)
+{
+    return d == column_wise ? row_wise : column_wise;
+}
+
+template <typename V, typename I>
+static compressed_ref<V, I> storage(const basic_sparse_matrix<V, I> &m)
+{
+    return compressed_ref<V, I>{m.getWidth(), m.getHeight(), m.getDir(), m.getPtr(), m.getIdx(), m.getValues()};
+}
+
+template <typename V, typename I>
+static compressed_ref<V, I> transposed_storage(const basic_sparse_matrix<V, I> &m)
+{
+    return compressed_ref<V, I>{m.getHeight(), m.getWidth(), other_dir(m.getDir()), m.getPtr(), m.getIdx(), m.getValues()};
+}
+
+// Product of operands compressed along the same direction
+template <typename V, typename I>
+static basic_sparse_matrix<V, I> product(const compressed_ref<V, I> &x, const compressed_ref<V, I> &y, int threads)
+{
+    vector<sparse_offset> ptr;
+    vector<I> idx;
+    vector<V> values;
+    if (x.dir == column_wise)
+        spgemm(x.height, y.width, x.ptr, x.idx, x.values, y.ptr, y.idx, y.values,
+               ptr, idx, values, threads);
+    else
+        spgemm(y.width, x.height, y.ptr, y.idx, y.values, x.ptr, x.idx, x.values,
+               ptr, idx, values, threads);
+    return basic_sparse_matrix<V, I>(y.width, x.height, x.dir, std::move(ptr), std::move(idx), std::move(values));
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::operator*(const basic_sparse_matrix &m) const
+{
+    return multiply(m, 1);
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::operator*(const transposed_type &m) const
+{
+    return multiply(m, 1);
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::multiply(const basic_sparse_matrix &m, int threads) const
+{
+    if (width != m.height)
+        throw std::runtime_error("Dimensions of matrices do not match");
+
+    if (symmetric || m.symmetric)
+        return toGeneral().multiply(m.toGeneral(), threads);
+
+    // Both operands have to be compressed the same way
+    if (dir != m.dir)
+    {
+        basic_sparse_matrix other(m);
+        other.toggleDir(threads);
+        return product(storage(*this), storage(other), threads);
+    }
+    return product(storage(*this), storage(m), threads);
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_sparse_matrix<V, I>::multiply(const transposed_type &m, int threads) const
+{
+    if (width != m.getHeight())
+        throw std::runtime_error("Dimensions of matrices do not match");
+
+    // Symmetric matrices are their own transpositions
+    if (m.matrix().symmetric)
+        return multiply(m.matrix(), threads);
+    if (symmetric)
+        return toGeneral().multiply(m, threads);
+
+    if (dir != m.getDir())
+    {
+        basic_sparse_matrix toggled(*this);
+        toggled.toggleDir(threads);
+        return product(storage(toggled), transposed_storage(m.matrix()), threads);
+    }
+    return product(storage(*this), transposed_storage(m.matrix()), threads);
+}
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I> &basic_sparse_matrix<V, I>::operator+=(const basic_sparse_matrix &m)
 {
     if(dir != m.getDir()) throw new std::runtime_error("adding matrices with different directions");
-    for (int i = 0; i < data.size(); i++)
-            data[i] += m[i];
+    *this = *this + m;
     return *this;
 }
 
-sparse_matrix &sparse_matrix::operator-=(const sparse_matrix &m)
+template <typename V, typename I>
+basic_sparse_matrix<V, I> &basic_sparse_matrix<V, I>::operator-=(const basic_sparse_matrix &m)
 {
-    for (int i = 0; i < width; i++)
-        for (int j = 0; j < height; j++)
-            data[i][j] -= m[i][j];
+    *this = *this - m;
     this->clean();
     return *this;
 }
 
-sparse_vector sparse_matrix::operator*(const sparse_vector &v) const
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_matrix<V, I>::operator*(const vector_type &v) const
+{
+    return multiply(v, 1);
+}
+
+template <typename V, typename I>
+dense_vector basic_sparse_matrix<V, I>::operator*(const dense_vector &v) const
 {
-    auto n = v.size();
-    sparse_vector result(n, v.getDir());
+    return multiply(v, 1);
+}
+
+// y = A * v for sparse v
+template <typename V, typename I>
+static basic_sparse_vector<V, I> spmv(const compressed_ref<V, I> &a, const basic_sparse_vector<V, I> &v)
+{
+    auto &v_idx = v.getIndices();
+    auto &v_val = v.getValues();
+
+    if (a.dir == row_wise)
+    {
+        // Gather - rows come out in order, so the result is appended directly.
+        // Row positions are sorted, so the search in v resumes where it stopped.
+        basic_sparse_vector<V, I> result(a.height, v.getDir());
+        for (I i = 0; i < a.height; i++)
+        {
+            double acc = 0.;
+            auto pos = v_idx.begin();
+            for (sparse_offset k = a.ptr[i]; k < a.ptr[i + 1] && pos != v_idx.end(); k++)
+            {
+                pos = std::lower_bound(pos, v_idx.end(), a.idx[k]);
+                if (pos != v_idx.end() && *pos == a.idx[k])
+                    acc += a.values[k] * v_val[pos - v_idx.begin()];
+            }
+            result.append(i, acc);
+        }
+        return result;
+    }
 
-    if (dir == row_wise)
+    // Scatter - only columns with a nonzero in v are touched, accumulating
+    // straight into the buffer that becomes the result
+    vector<V> y(a.height, 0.0);
+    for (I l = 0; l < v_idx.size(); l++)
     {
+        I j = v_idx[l];
+        V xj = v_val[l];
+        for (sparse_offset k = a.ptr[j]; k < a.ptr[j + 1]; k++)
+            y[a.idx[k]] += a.values[k] * xj;
+    }
+    return basic_sparse_vector<V, I>(std::move(y), v.getDir());
+}
+
+// y = A * x for A keeping only its lower triangle. Every stored item adds to
+// y at its own position and, below the diagonal, at the mirrored one in the
+// same pass. Threads scatter to their own buffers summed at the end.
+template <typename V, typename I>
+static dense_vector spmv_symmetric(const compressed_ref<V, I> &a, const dense_vector &v, const vector<I> &bounds)
+{
+    int threads = bounds.size() - 1;
+    I n = a.height;
+    dense_vector result(n, v.getDir());
+    double *y = result.getData();
+    const double *x = v.getData();
+    const sparse_offset *ptr = a.ptr.data();
+    const I *idx = a.idx.data();
+    const V *values = a.values.data();
+
+    result.fill(0);
+    arena_scope scope;
+    scratch_vector<double> partial((size_t)(threads - 1) * n, 0.0, scope);
+    #pragma omp parallel num_threads(threads) if(threads > 1)
+    {
+        #pragma omp for schedule(static, 1)
+        for (int t = 0; t < threads; t++)
+        {
+            double *out = t == 0 ? y : partial.data() + (size_t)(t - 1) * n;
+            for (I i = bounds[t]; i < bounds[t + 1]; i++)
+            {
+                double xi = x[i], acc = 0.;
+                for (sparse_offset k = ptr[i]; k < ptr[i + 1]; k++)
+                {
+                    I j = idx[k];
+                    out[j] += values[k] * xi;
+                    if (j != i) acc += values[k] * x[j];
+                }
+                out[i] += acc;
+            }
+        }
+
+        #pragma omp for schedule(static)
         for (int i = 0; i < n; i++)
-            result[i] = data[i].dot(v);
+            for (int t = 1; t < threads; t++)
+                y[i] += partial[(size_t)(t - 1) * n + i];
+    }
+
+    return result;
+}
+
+// y = A * x, threads split stored vectors at bounds
+template <typename V, typename I>
+static dense_vector spmv(const compressed_ref<V, I> &a, const dense_vector &v, const vector<I> &bounds)
+{
+    int threads = bounds.size() - 1;
+    dense_vector result(a.height, v.getDir());
+    double *y = result.getData();
+    const double *x = v.getData();
+    const sparse_offset *ptr = a.ptr.data();
+    const I *idx = a.idx.data();
+    const V *values = a.values.data();
+
+    if (a.dir == row_wise)
+    {
+        // Gather - threads own disjoint blocks of rows with equal nnz
+        #pragma omp parallel for num_threads(threads) schedule(static, 1) if(threads > 1)
+        for (int t = 0; t < threads; t++)
+            for (I i = bounds[t]; i < bounds[t + 1]; i++)
+            {
+                double acc = 0.;
+                for (sparse_offset k = ptr[i]; k < ptr[i + 1]; k++)
+                    acc += values[k] * x[idx[k]];
+                y[i] = acc;
+            }
     } else {
-        auto local = *this;
-        local.toggleDir();
-        for (int i = 0; i < n; i++)
-            result[i] = local[i].dot(v);
+        // Scatter - every block of columns goes to its own buffer (the first
+        // one straight to the result), buffers are then summed row by row
+        I height = a.height;
+        arena_scope scope;
+        scratch_vector<double> partial((size_t)(threads - 1) * height, 0.0, scope);
+        #pragma omp parallel num_threads(threads) if(threads > 1)
+        {
+            #pragma omp for schedule(static, 1)
+            for (int t = 0; t < threads; t++)
+            {
+                double *out = t == 0 ? y : partial.data() + (size_t)(t - 1) * height;
+                for (I j = bounds[t]; j < bounds[t + 1]; j++)
+                {
+                    double xj = x[j];
+                    if (xj == 0) continue;
+                    for (sparse_offset k = ptr[j]; k < ptr[j + 1]; k++)
+                        out[idx[k]] += values[k] * xj;
+                }
+            }
+
+            #pragma omp for schedule(static)
+            for (I i = 0; i < height; i++)
+                for (int t = 1; t < threads; t++)
+                    y[i] += partial[(size_t)(t - 1) * height + i];
+        }
     }
 
     return result;
 }
 
-sparse_vector &sparse_matrix::operator[](size_t el)
-{ return data[el]; }
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_matrix<V, I>::multiply(const vector_type &v, int threads) const
+{
+    if (v.size() != width)
+        throw std::runtime_error("Dimensions of matrix and vector do not match");
+
+    // Threads and the symmetric kernel work on dense buffers anyway
+    if (threads > 1 || symmetric)
+        return multiply(dense_vector(v), threads).template toSparse<V, I>();
+    return spmv(storage(*this), v);
+}
+
+template <typename V, typename I>
+dense_vector basic_sparse_matrix<V, I>::multiply(const dense_vector &v, int threads) const
+{
+    if (v.size() != width)
+        throw std::runtime_error("Dimensions of matrix and vector do not match");
+    if (symmetric)
+        return spmv_symmetric(storage(*this), v, partition(threads));
+    return spmv(storage(*this), v, partition(threads));
+}
+
+template <typename V, typename I>
+basic_transposed_matrix<V, I> basic_sparse_matrix<V, I>::transposed() const
+{
+    return transposed_type(*this);
+}
+
+// TRANSPOSED VIEW
+
+template <typename V, typename I>
+basic_transposed_matrix<V, I>::basic_transposed_matrix(const matrix_type &m) : m(&m)
+{ }
+
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_transposed_matrix<V, I>::operator*(const matrix_type &other) const
+{
+    return multiply(other, 1);
+}
+
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_transposed_matrix<V, I>::operator*(const vector_type &v) const
+{
+    return multiply(v, 1);
+}
 
-const sparse_vector &sparse_matrix::operator[](size_t el) const
-{ return data[el]; }
+template <typename V, typename I>
+dense_vector basic_transposed_matrix<V, I>::operator*(const dense_vector &v) const
+{
+    return multiply(v, 1);
+}
 
-bool sparse_matrix::operator==(const sparse_matrix &m)
+template <typename V, typename I>
+basic_sparse_matrix<V, I> basic_transposed_matrix<V, I>::multiply(const matrix_type &other, int threads) const
 {
+    if (getWidth() != other.getHeight())
+        throw std::runtime_error("Dimensions of matrices do not match");
+
+    if (m->symmetric || other.symmetric)
+        return basic_transposed_matrix(m->toGeneral()).multiply(other.toGeneral(), threads);
+
+    if (getDir() != other.getDir())
+    {
+        matrix_type toggled(other);
+        toggled.toggleDir(threads);
+        return product(transposed_storage(*m), storage(toggled), threads);
+    }
+    return product(transposed_storage(*m), storage(other), threads);
+}
+
+// Scatter over rows of a row-wise matrix or gather over columns of a
+// column-wise one, whichever the stored orientation gives
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_transposed_matrix<V, I>::multiply(const vector_type &v, int threads) const
+{
+    if (v.size() != getWidth())
+        throw std::runtime_error("Dimensions of matrix and vector do not match");
+
+    if (threads > 1 || m->symmetric)
+        return multiply(dense_vector(v), threads).template toSparse<V, I>();
+    return spmv(transposed_storage(*m), v);
+}
+
+template <typename V, typename I>
+dense_vector basic_transposed_matrix<V, I>::multiply(const dense_vector &v, int threads) const
+{
+    if (v.size() != getWidth())
+        throw std::runtime_error("Dimensions of matrix and vector do not match");
+    if (m->symmetric)
+        return m->multiply(v, threads);
+    return spmv(transposed_storage(*m), v, m->partition(threads));
+}
+
+template <typename V, typename I>
+const basic_sparse_matrix<V, I> &basic_transposed_matrix<V, I>::matrix() const
+{ return *m; }
+
+template <typename V, typename I>
+I basic_transposed_matrix<V, I>::getWidth() const
+{ return m->getHeight(); }
+
+template <typename V, typename I>
+I basic_transposed_matrix<V, I>::getHeight() const
+{ return m->getWidth(); }
+
+template <typename V, typename I>
+direction basic_transposed_matrix<V, I>::getDir() const
+{ return other_dir(m->getDir()); }
+
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_matrix<V, I>::operator[](size_t el) const
+{
+    if (el >= majorSize())
+        throw std::runtime_error("index out of bounds");
+    if (symmetric)
+    {
+        // Items above the diagonal are looked up in vectors before el
+        vector_type result(minorSize(), dir);
+        for (I j = 0; j < minorSize(); j++)
+            result.append(j, get(el, j));
+        return result;
+    }
+    return vector_type(minorSize(), dir,
+            vector<I>(idx.begin() + ptr[el], idx.begin() + ptr[el + 1]),
+            vector<V>(values.begin() + ptr[el], values.begin() + ptr[el + 1]));
+}
+
+template <typename V, typename I>
+bool basic_sparse_matrix<V, I>::operator==(const basic_sparse_matrix &m)
+{
+    if (symmetric || m.symmetric)
+        return toGeneral() == m.toGeneral();
+    if (dir != m.getDir())
+    {
+        basic_sparse_matrix other(m);
+        other.toggleDir();
+        return *this == other;
+    }
     try
     {
-        for (int i = 0; i < data.size(); i++)
-            if (data[i] != m[i]) return false;
+        for (I i = 0; i < majorSize(); i++)
+            if ((*this)[i] != m[i]) return false;
         return true;
     } catch (...)
     {
@@ -98,7 +580,11 @@ bool sparse_matrix::operator==(const sparse_matrix &m)
     }
 }
 
-bool sparse_matrix::operator!=(const sparse_matrix &m)
+template <typename V, typename I>
+bool basic_sparse_matrix<V, I>::operator!=(const basic_sparse_matrix &m)
 {
     return !(*this == m);
 }
+
+INSTANTIATE_SPARSE(basic_sparse_matrix)
+INSTANTIATE_SPARSE(basic_transposed_matrix)
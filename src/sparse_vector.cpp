@@ -3,224 +3,397 @@
 //
 
 #include "sparse_vector.h"
+#include "sparse_kernels.h"
 #include <math.h>
 #include <stdexcept>
 #include <stdio.h>
 #include <assert.h>
+#include <algorithm>
+#include <utility>
 
 // CONSTRUCTORS
 
-sparse_vector::sparse_vector() : length(0)
+template <typename V, typename I>
+basic_sparse_vector<V, I>::basic_sparse_vector() : length(0)
 { }
 
-sparse_vector::sparse_vector(int len) : length(len)
+template <typename V, typename I>
+basic_sparse_vector<V, I>::basic_sparse_vector(I len) : length(len)
 { }
 
-sparse_vector::sparse_vector(direction dir) : length(0), dir(dir)
+template <typename V, typename I>
+basic_sparse_vector<V, I>::basic_sparse_vector(direction dir) : length(0), dir(dir)
 { }
 
-sparse_vector::sparse_vector(int len, direction dir) : length(len), dir(dir)
+template <typename V, typename I>
+basic_sparse_vector<V, I>::basic_sparse_vector(I len, direction dir) : length(len), dir(dir)
 { }
 
-sparse_vector::sparse_vector(int len, direction dir, std::vector<sparse_matrix_elem> elements)
+template <typename V, typename I>
+basic_sparse_vector<V, I>::basic_sparse_vector(I len, direction dir, std::vector<elem_type> elements)
 		: length(len), dir(dir)
 {
 	for (auto it = elements.begin(); it != elements.end(); it++)
 		set(dir == column_wise ? it->row : it->col, it->value);
 }
 
-sparse_vector::~sparse_vector()
+// Indices must be sorted ascending and values must not contain zeros
+template <typename V, typename I>
+basic_sparse_vector<V, I>::basic_sparse_vector(I len, direction dir, std::vector<I> indices, std::vector<V> values)
+		: indices(std::move(indices)), values(std::move(values)), length(len), dir(dir)
 { }
 
-sparse_vector::sparse_vector(const sparse_vector &other)
+// Keeps nonzeros of dense in its own buffer, compacting them in place
+template <typename V, typename I>
+basic_sparse_vector<V, I>::basic_sparse_vector(std::vector<V> dense, direction dir)
+		: values(std::move(dense)), length(values.size()), dir(dir)
 {
-	data = other.data;
+	I n = 0;
+	for (I i = 0; i < length; i++)
+		if (values[i] != 0) n++;
+	indices.resize(n);
+	for (I i = 0, k = 0; i < length; i++)
+	{
+		if (values[i] == 0) continue;
+		indices[k] = i;
+		values[k++] = values[i];
+	}
+	values.resize(n);
+}
+
+template <typename V, typename I>
+basic_sparse_vector<V, I>::~basic_sparse_vector()
+{ }
+
+template <typename V, typename I>
+basic_sparse_vector<V, I>::basic_sparse_vector(const basic_sparse_vector<V, I> &other)
+{
+	indices = other.indices;
+	values = other.values;
 	length = other.length;
 	dir = other.dir;
 }
 
+template <typename V, typename I>
+basic_sparse_vector<V, I>::basic_sparse_vector(basic_sparse_vector<V, I> &&other)
+		: indices(std::move(other.indices)), values(std::move(other.values)), length(other.length), dir(other.dir)
+{
+	other.indices.clear();
+	other.values.clear();
+}
+
+template <typename V, typename I>
+basic_sparse_vector<V, I> &basic_sparse_vector<V, I>::operator=(const basic_sparse_vector<V, I> &other)
+{
+	if (this == &other) return *this;
+	basic_sparse_vector tmp(other);
+	return *this = std::move(tmp);
+}
+
+template <typename V, typename I>
+basic_sparse_vector<V, I> &basic_sparse_vector<V, I>::operator=(basic_sparse_vector<V, I> &&other)
+{
+	indices.swap(other.indices);
+	values.swap(other.values);
+	std::swap(length, other.length);
+	std::swap(dir, other.dir);
+	return *this;
+}
+
 // GETTERS AND SETTERS
 
-double sparse_vector::get(int nIndex) const
+// Position of the first stored index not less than index
+template <typename V, typename I>
+I basic_sparse_vector<V, I>::find(I index) const
+{
+	return std::lower_bound(indices.begin(), indices.end(), index) - indices.begin();
+}
+
+template <typename V, typename I>
+V basic_sparse_vector<V, I>::get(I nIndex) const
 {
 	if (nIndex >= length || nIndex < 0)
 		throw std::runtime_error("index out of bounds");
-	if (data.count(nIndex) > 0)
-		return data.at(nIndex);
+	I pos = find(nIndex);
+	if (pos < indices.size() && indices[pos] == nIndex)
+		return values[pos];
 	return 0;
 }
 
-void sparse_vector::set(std::pair<int, double> item)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::set(std::pair<I, V> item)
 {
 	if (item.first >= length) length = item.first + 1;
-	if (item.second == 0) return;
-	if (data.count(item.first) > 0)
-		data[item.first] = item.second;
-	data.insert(item);
+	I pos = find(item.first);
+	bool found = pos < indices.size() && indices[pos] == item.first;
+	if (item.second == 0)
+	{
+		if (found)
+		{
+			indices.erase(indices.begin() + pos);
+			values.erase(values.begin() + pos);
+		}
+		return;
+	}
+	if (found)
+		values[pos] = item.second;
+	else
+	{
+		indices.insert(indices.begin() + pos, item.first);
+		values.insert(values.begin() + pos, item.second);
+	}
 }
 
-void sparse_vector::set(int index, double value)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::set(I index, V value)
 {
 	this->set(std::make_pair(index, value));
 }
 
-void sparse_vector::reset(int len)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::append(I index, V value)
+{
+	if (!indices.empty() && index <= indices.back())
+		throw std::runtime_error("appended index must be greater than stored ones");
+	if (index >= length) length = index + 1;
+	if (value == 0) return;
+	indices.push_back(index);
+	values.push_back(value);
+}
+
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::reserve(I n)
+{
+	indices.reserve(n);
+	values.reserve(n);
+}
+
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::reset(I len)
 {
 	length = len;
 	//data.clear();
 }
 
-void sparse_vector::reset(int len, direction d)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::reset(I len, direction d)
 {
 	dir = d;
 	reset(len);
 }
 
-int sparse_vector::size() const
+template <typename V, typename I>
+I basic_sparse_vector<V, I>::size() const
 {
 	return length;
 }
 
-direction sparse_vector::getDir() const
+template <typename V, typename I>
+I basic_sparse_vector<V, I>::getNnz() const
+{
+	return values.size();
+}
+
+template <typename V, typename I>
+const std::vector<I> &basic_sparse_vector<V, I>::getIndices() const
+{
+	return indices;
+}
+
+template <typename V, typename I>
+const std::vector<V> &basic_sparse_vector<V, I>::getValues() const
+{
+	return values;
+}
+
+template <typename V, typename I>
+direction basic_sparse_vector<V, I>::getDir() const
 {
 	return dir;
 }
 
-void sparse_vector::setDir(direction d)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::setDir(direction d)
 {
 	dir = d;
 }
 
-void sparse_vector::clean()
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::clean()
 {
-	for (auto it = data.begin(); it != data.end();)
+	I n = 0;
+	for (I k = 0; k < values.size(); k++)
 	{
-		if (fabs(it->second) < 1e-6) data.erase(it++);
-		else ++it;
+		if (fabs(values[k]) < 1e-6) continue;
+		indices[n] = indices[k];
+		values[n] = values[k];
+		n++;
 	}
+	indices.resize(n);
+	values.resize(n);
 }
 
-void sparse_vector::clear()
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::clear()
 {
-	data.clear();
+	indices.clear();
+	values.clear();
 }
 
 // OPERATIONS
 
-void sparse_vector::add(std::pair<int, double> item)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::add(std::pair<I, V> item)
 {
 	if (item.first >= length)
 		throw std::runtime_error("add/sub value to/from non existing item");
 	if (item.second == 0) return;
-	if (data.count(item.first) > 0)
-		data[item.first] += item.second;
-	else data.insert(item);
-	if (data[item.first] == 0) data.erase(item.first);
+	I pos = find(item.first);
+	if (pos < indices.size() && indices[pos] == item.first)
+	{
+		values[pos] += item.second;
+		if (values[pos] == 0)
+		{
+			indices.erase(indices.begin() + pos);
+			values.erase(values.begin() + pos);
+		}
+	}
+	else
+	{
+		indices.insert(indices.begin() + pos, item.first);
+		values.insert(values.begin() + pos, item.second);
+	}
 }
 
-void sparse_vector::add(int index, double value)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::add(I index, V value)
 {
 	this->add(std::make_pair(index, value));
 }
 
-void sparse_vector::sub(std::pair<int, double> item)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::sub(std::pair<I, V> item)
 {
 	item.second = -item.second;
 	this->add(item);
 }
 
-void sparse_vector::sub(int index, double value)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::sub(I index, V value)
 {
 	this->sub(std::make_pair(index, value));
 }
 
-void sparse_vector::mul(std::pair<int, double> item)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::mul(std::pair<I, V> item)
 {
 	if (item.first >= length)
 		throw std::runtime_error("mul a non existing item");
-	if (data.count(item.first) > 0)
+	I pos = find(item.first);
+	if (pos < indices.size() && indices[pos] == item.first)
 	{
-		if (item.second == 0) data.erase(item.first);
-		data[item.first] *= item.second;
+		if (item.second == 0)
+		{
+			indices.erase(indices.begin() + pos);
+			values.erase(values.begin() + pos);
+		}
+		else values[pos] *= item.second;
 	}
 }
 
-void sparse_vector::mul(int index, double value)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::mul(I index, V value)
 {
 	this->mul(std::make_pair(index, value));
 }
 
-void sparse_vector::div(std::pair<int, double> item)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::div(std::pair<I, V> item)
 {
 	if (item.second == 0)
 		throw std::runtime_error("division by zero");
 	if (item.first >= length)
 		throw std::runtime_error("mul a non existing item");
-	if (data.count(item.first) > 0)
-	{
-		if (item.second == 0) throw new std::runtime_error("divide by zero!");
-		else data[item.first] /= item.second;
-	}
+	I pos = find(item.first);
+	if (pos < indices.size() && indices[pos] == item.first)
+		values[pos] /= item.second;
 }
 
-void sparse_vector::div(int index, double value)
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::div(I index, V value)
 {
 	this->div(std::make_pair(index, value));
 }
 
 // OTHER
 
-std::vector<sparse_matrix_elem> sparse_vector::getElements(direction d, int x) const
+template <typename V, typename I>
+std::vector<typename basic_sparse_vector<V, I>::elem_type> basic_sparse_vector<V, I>::getElements(direction d, I x) const
 {
-	std::vector<sparse_matrix_elem> result;
+	std::vector<elem_type> result;
+	result.reserve(values.size());
 	if (d == column_wise)
-		for (auto it = data.cbegin(); it != data.cend(); it++)
-			result.push_back(sparse_matrix_elem{x, it->first, it->second});
+		for (I k = 0; k < values.size(); k++)
+			result.push_back(elem_type{x, indices[k], values[k]});
 	else
-		for (auto it = data.cbegin(); it != data.cend(); it++)
-			result.push_back(sparse_matrix_elem{it->first, x, it->second});
+		for (I k = 0; k < values.size(); k++)
+			result.push_back(elem_type{indices[k], x, values[k]});
 	return result;
 }
 
-void sparse_vector::print() const
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::print() const
 {
-	for (auto it = data.cbegin(); it != data.cend(); it++)
-		printf("(%d)=>%f", it->first, it->second);
+	for (I k = 0; k < values.size(); k++)
+		printf("(%lld)=>%f", (long long)indices[k], (double)values[k]);
 	printf("\n");
 }
 
-double sparse_vector::l2_norm() const
+template <typename V, typename I>
+double basic_sparse_vector<V, I>::l2_norm() const
 {
 	double acc = 0.;
-	for (auto it = data.cbegin(); it != data.cend(); it++)
-		acc += it->second * it->second;
+	for (I k = 0; k < values.size(); k++)
+		acc += values[k] * values[k];
 	return sqrt(acc);
 }
 
-double sparse_vector::sum() const
+template <typename V, typename I>
+double basic_sparse_vector<V, I>::sum() const
 {
 	double acc = 0.;
-	for (auto it = data.cbegin(); it != data.cend(); it++)
-		acc += it->second ;
+	for (I k = 0; k < values.size(); k++)
+		acc += values[k];
 	return acc;
 }
 
-double sparse_vector::dot(const sparse_vector &other) const
+template <typename V, typename I>
+double basic_sparse_vector<V, I>::dot(const basic_sparse_vector<V, I> &other) const
 {
-	double acc = 0.;
 	assert(this->size() == other.size());
-	for(int i=0; i<length; i++)
-		acc += (*this)[i] * other[i];
+	return sparse_dot<V, I>(indices.data(), values.data(), values.size(),
+							other.indices.data(), other.values.data(), other.values.size());
+}
 
-	return acc;
+// this = this + a * x
+template <typename V, typename I>
+void basic_sparse_vector<V, I>::axpy(double a, const basic_sparse_vector<V, I> &x)
+{
+	assert(length == x.size());
+	if (a == 0 || x.values.empty()) return;
+	*this = merge(x, a);
 }
 
-std::map<int, double>::const_iterator sparse_vector::cbegin() const
+template <typename V, typename I>
+typename basic_sparse_vector<V, I>::const_iterator basic_sparse_vector<V, I>::cbegin() const
 {
-	return data.cbegin();
+	return const_iterator(indices.data(), values.data());
 }
 
-std::map<int, double>::const_iterator sparse_vector::cend() const
+template <typename V, typename I>
+typename basic_sparse_vector<V, I>::const_iterator basic_sparse_vector<V, I>::cend() const
 {
-	return data.cend();
+	return const_iterator(indices.data() + indices.size(), values.data() + values.size());
 }
+
+INSTANTIATE_SPARSE(basic_sparse_vector)
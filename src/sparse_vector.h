@@ -5,93 +5,221 @@
 #ifndef MPI_MATRICES_SPARSE_VECTOR_H
 #define MPI_MATRICES_SPARSE_VECTOR_H
 
-#include <map>
+#include <utility>
 #include <vector>
 #include "direction.h"
 #include "sparse_matrix_elem.h"
 
-class sparse_vector
+template <typename V, typename I>
+class basic_sparse_vector
 {
+// TYPES
+public:
+	typedef V value_type;
+	typedef I index_type;
+	typedef basic_sparse_matrix_elem<V, I> elem_type;
+
+// ITERATOR
+public:
+	// Walks stored items in ascending index order yielding (index, value)
+	// pairs, the same way a std::map<I, V> iterator would
+	class const_iterator
+	{
+	private:
+		const I *index;
+		const V *value;
+		mutable std::pair<I, V> current;
+
+	public:
+		const_iterator(const I *index, const V *value)
+				: index(index), value(value)
+		{ }
+
+		std::pair<I, V> operator*() const
+		{ return std::make_pair(*index, *value); }
+
+		const std::pair<I, V> *operator->() const
+		{
+			current = std::make_pair(*index, *value);
+			return &current;
+		}
+
+		const_iterator &operator++()
+		{
+			++index;
+			++value;
+			return *this;
+		}
+
+		const_iterator operator++(int)
+		{
+			const_iterator tmp(*this);
+			++(*this);
+			return tmp;
+		}
+
+		bool operator==(const const_iterator &other) const
+		{ return index == other.index; }
+
+		bool operator!=(const const_iterator &other) const
+		{ return index != other.index; }
+	};
+
+// REFERENCE
+public:
+	// Item returned by the non-const operator[]. Reading goes through get()
+	// and stores nothing - only assignments store the item, through set()
+	// and the other item operations.
+	class reference
+	{
+	private:
+		basic_sparse_vector &vector;
+		I index;
+
+	public:
+		reference(basic_sparse_vector &vector, I index)
+				: vector(vector), index(index)
+		{ }
+
+		operator V() const
+		{ return vector.get(index); }
+
+		reference &operator=(V value)
+		{
+			vector.set(index, value);
+			return *this;
+		}
+
+		reference &operator=(const reference &other)
+		{ return *this = (V)other; }
+
+		reference &operator+=(V value)
+		{
+			vector.add(index, value);
+			return *this;
+		}
+
+		reference &operator-=(V value)
+		{
+			vector.sub(index, value);
+			return *this;
+		}
+
+		reference &operator*=(V value)
+		{
+			vector.set(index, vector.get(index) * value);
+			return *this;
+		}
+
+		reference &operator/=(V value)
+		{
+			vector.set(index, vector.get(index) / value);
+			return *this;
+		}
+	};
+
 // FIELDS
 private:
-	std::map<int, double> data;
-	int length;
+	// Stored items as sorted parallel arrays
+	std::vector<I> indices;
+	std::vector<V> values;
+	I length;
 	direction dir;
 
 // CONSTRUCTORS
 public:
-	sparse_vector();
-	sparse_vector(int len);
-	sparse_vector(direction dir);
-	sparse_vector(int len, direction dir);
-	sparse_vector(int len, direction dir, std::vector<sparse_matrix_elem> elements);
-	sparse_vector(const sparse_vector &other);
-	~sparse_vector();
+	basic_sparse_vector();
+	basic_sparse_vector(I len);
+	basic_sparse_vector(direction dir);
+	basic_sparse_vector(I len, direction dir);
+	basic_sparse_vector(I len, direction dir, std::vector<elem_type> elements);
+	basic_sparse_vector(I len, direction dir, std::vector<I> indices, std::vector<V> values);
+	basic_sparse_vector(std::vector<V> dense, direction dir);
+	basic_sparse_vector(const basic_sparse_vector &other);
+	basic_sparse_vector(basic_sparse_vector &&other);
+	~basic_sparse_vector();
+
+	basic_sparse_vector &operator=(const basic_sparse_vector &other);
+	basic_sparse_vector &operator=(basic_sparse_vector &&other);
 
 private:
-	sparse_vector(double);
-	sparse_vector(float);
+	basic_sparse_vector(double);
+	basic_sparse_vector(float);
 
 // OPERATORS
 public:
-	double &operator[](int el);
-	const double operator[](int el) const;
+	reference operator[](I el);
+	const V operator[](I el) const;
 
-	sparse_vector operator+(const sparse_vector &v) const;
-	sparse_vector operator-(const sparse_vector &v) const;
-	std::vector<sparse_matrix_elem> operator*(const sparse_vector &v) const;
+	basic_sparse_vector operator+(const basic_sparse_vector &v) const;
+	basic_sparse_vector operator-(const basic_sparse_vector &v) const;
+	std::vector<elem_type> operator*(const basic_sparse_vector &v) const;
 
-	sparse_vector operator+(const double &d) const;
-	sparse_vector operator-(const double &d) const;
-	sparse_vector operator*(const double &d) const;
-	sparse_vector operator/(const double &d) const;
+	basic_sparse_vector operator+(const double &d) const;
+	basic_sparse_vector operator-(const double &d) const;
+	basic_sparse_vector operator*(const double &d) const;
+	basic_sparse_vector operator/(const double &d) const;
 
-	sparse_vector& operator+=(const double &d);
-	sparse_vector& operator-=(const double &d);
-	sparse_vector& operator*=(const double &d);
-	sparse_vector& operator/=(const double &d);
+	basic_sparse_vector& operator+=(const double &d);
+	basic_sparse_vector& operator-=(const double &d);
+	basic_sparse_vector& operator*=(const double &d);
+	basic_sparse_vector& operator/=(const double &d);
 
-	sparse_vector& operator+=(const sparse_vector &v);
-	sparse_vector& operator-=(const sparse_vector &v);
+	basic_sparse_vector& operator+=(const basic_sparse_vector &v);
+	basic_sparse_vector& operator-=(const basic_sparse_vector &v);
 
-	bool operator==(const sparse_vector &v) const;
-	bool operator!=(const sparse_vector &v) const;
+	bool operator==(const basic_sparse_vector &v) const;
+	bool operator!=(const basic_sparse_vector &v) const;
 
 // GETTERS AND SETTERS
 public:
-	double get(int nIndex) const;
+	V get(I nIndex) const;
 	direction getDir() const;
-	std::map<int, double>::const_iterator cbegin() const;
-	std::map<int, double>::const_iterator cend() const;
-	void set(std::pair<int, double> item);
-	void set(int index, double value);
+	I getNnz() const;
+	const std::vector<I> &getIndices() const;
+	const std::vector<V> &getValues() const;
+	const_iterator cbegin() const;
+	const_iterator cend() const;
+	void set(std::pair<I, V> item);
+	void set(I index, V value);
 	void setDir(direction d);
 
 // METHODS
 public:
 	// OPERATIONS
-	void add(std::pair<int, double> item);
-	void add(int index, double value);
-	void sub(std::pair<int, double> item);
-	void sub(int index, double value);
-	void mul(std::pair<int, double> item);
-	void mul(int index, double value);
-	void div(std::pair<int, double> item);
-	void div(int index, double value);
+	void add(std::pair<I, V> item);
+	void add(I index, V value);
+	void sub(std::pair<I, V> item);
+	void sub(I index, V value);
+	void mul(std::pair<I, V> item);
+	void mul(I index, V value);
+	void div(std::pair<I, V> item);
+	void div(I index, V value);
 
 	// UTILITY
-	void reset(int len);
-	void reset(int len, direction d);
-	int size() const;
+	void append(I index, V value);
+	void reserve(I n);
+	void reset(I len);
+	void reset(I len, direction d);
+	I size() const;
 	void clean();
 	void clear();
 	void print() const;
 
 	// OTHER
-	std::vector<sparse_matrix_elem> getElements(direction d, int x = 0) const;
+	std::vector<elem_type> getElements(direction d, I x = 0) const;
 	double l2_norm() const;
 	double sum() const;
-	double dot(const sparse_vector &other) const;
+	double dot(const basic_sparse_vector &other) const;
+	void axpy(double a, const basic_sparse_vector &x);
+
+private:
+	I find(I index) const;
+	basic_sparse_vector merge(const basic_sparse_vector &v, double factor) const;
+	basic_sparse_vector shift(double d) const;
 };
 
+// Vector of double values at int positions used throughout the solvers
+typedef basic_sparse_vector<double, int> sparse_vector;
+
 #endif //MPI_MATRICES_SPARSE_VECTOR_H
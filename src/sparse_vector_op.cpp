@@ -4,176 +4,200 @@
 
 #include <assert.h>
 #include "sparse_vector.h"
+#include "sparse_kernels.h"
 #include <math.h>
 #include <stdexcept>
 
-sparse_vector sparse_vector::operator+(const sparse_vector &m) const
+// Returns this + factor * v merging both sorted index arrays in one pass
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_vector<V, I>::merge(const basic_sparse_vector<V, I> &v, double factor) const
+{
+	basic_sparse_vector result(length, dir);
+	result.reserve(values.size() + v.values.size());
+	sparse_axpy<V, I>(indices.data(), values.data(), values.size(),
+					  factor, v.indices.data(), v.values.data(), v.values.size(),
+					  result.indices, result.values);
+	return result;
+}
+
+// Returns vector with d added to every position, including not stored ones
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_vector<V, I>::shift(double d) const
+{
+	basic_sparse_vector result(length, dir);
+	result.reserve(length);
+	for (I i = 0, k = 0; i < length; i++)
+	{
+		double value = d;
+		if (k < indices.size() && indices[k] == i)
+			value += values[k++];
+		if (value != 0)
+		{
+			result.indices.push_back(i);
+			result.values.push_back(value);
+		}
+	}
+	return result;
+}
+
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_vector<V, I>::operator+(const basic_sparse_vector<V, I> &m) const
 {
 	if(length != m.length) throw new std::runtime_error("size of vectors must match!");
-	auto result = sparse_vector(m);
-	for (auto it = data.cbegin(); it != data.cend(); it++)
-		result.add(*it);
+	auto result = merge(m, 1.0);
 	result.clean();
 	return result;
 }
 
-sparse_vector sparse_vector::operator-(const sparse_vector &m) const
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_vector<V, I>::operator-(const basic_sparse_vector<V, I> &m) const
 {
-	auto result = sparse_vector(*this);
-	for (auto it = m.data.cbegin(); it != m.data.cend(); it++)
-		result.sub(*it);
+	auto result = merge(m, -1.0);
 	result.clean();
 	return result;
 }
 
-std::vector<sparse_matrix_elem> sparse_vector::operator*(const sparse_vector &m) const
+template <typename V, typename I>
+std::vector<typename basic_sparse_vector<V, I>::elem_type> basic_sparse_vector<V, I>::operator*(const basic_sparse_vector<V, I> &m) const
 {
-	auto result = std::vector<sparse_matrix_elem>{};
-	auto value = double{ 0.0f };
+	auto result = std::vector<elem_type>{};
+	V value = 0;
 	if (dir == row_wise && m.dir == column_wise) // result will be one double
 	{
-		for (int i = 0; i < length; i++)
-			value += get(i) * m.get(i);
+		value = dot(m);
 		if (value != 0)
-			result.push_back(sparse_matrix_elem{0, 0, value});
+			result.push_back(elem_type{0, 0, value});
 	}
 	else if (dir == m.dir) // result will be vector
 	{
-		for (int i = 0; i < length; i++)
+		for (I i = 0; i < length; i++)
 		{
 			value = get(i) * m.get(i);
 			if (value == 0) continue;
 			if (dir == column_wise)
-				result.push_back(sparse_matrix_elem{0, i, value});
-			else result.push_back(sparse_matrix_elem{i, 0, value});
+				result.push_back(elem_type{0, i, value});
+			else result.push_back(elem_type{i, 0, value});
 		}
 	}
 	else // result will be matrix
 	{
-		for (auto it = data.cbegin(); it != data.cend(); it++)
+		for (auto it = cbegin(); it != cend(); it++)
 		{
 			for (auto it_m = m.cbegin(); it_m != m.cend(); it_m++)
 			{
 				value = it->second * it_m->second;
 				if (value != 0)
-					result.push_back(sparse_matrix_elem{it_m->first, it->first, value});
+					result.push_back(elem_type{it_m->first, it->first, value});
 			}
 		}
 	}
 	return result;
 }
 
-sparse_vector sparse_vector::operator*(const double &m) const
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_vector<V, I>::operator*(const double &m) const
 {
-	auto result = sparse_vector(*this);
-	for (int i = 0; i < result.size(); i++)
-		result.mul(i, m);
+	auto result = basic_sparse_vector(*this);
+	result *= m;
 	return result;
 }
 
-sparse_vector sparse_vector::operator/(const double &m) const
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_vector<V, I>::operator/(const double &m) const
 {
-	auto result = sparse_vector(*this);
-	if (m == 0)
-		throw std::runtime_error("division by zero");
-	for (int i = 0; i < result.size(); i++)
-		result.div(i, m);
+	auto result = basic_sparse_vector(*this);
+	result /= m;
 	return result;
 }
 
-sparse_vector sparse_vector::operator+(const double &m) const
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_vector<V, I>::operator+(const double &m) const
 {
-	auto result = sparse_vector(*this);
-	if (m == 0) return result;
-	for (int i = 0; i < result.size(); i++)
-		result.add(i, m);
-	return result;
+	if (m == 0) return basic_sparse_vector(*this);
+	return shift(m);
 }
 
-sparse_vector sparse_vector::operator-(const double &m) const
+template <typename V, typename I>
+basic_sparse_vector<V, I> basic_sparse_vector<V, I>::operator-(const double &m) const
 {
-	auto result = sparse_vector(*this);
-	if (m == 0) return result;
-	for (int i = 0; i < result.size(); i++)
-		result.sub(i, m);
-	return result;
+	if (m == 0) return basic_sparse_vector(*this);
+	return shift(-m);
 }
 
-double& sparse_vector::operator[](int nIndex)
+template <typename V, typename I>
+typename basic_sparse_vector<V, I>::reference basic_sparse_vector<V, I>::operator[](I nIndex)
 {
 	if (nIndex >= length || nIndex < 0)
 		throw std::runtime_error("index out of bounds");
-	if (data.count(nIndex) <= 0)
-		data.insert(std::make_pair(nIndex,0));
-	return data[nIndex];
+	return reference(*this, nIndex);
 }
 
-const double sparse_vector::operator[](int el) const
+template <typename V, typename I>
+const V basic_sparse_vector<V, I>::operator[](I el) const
 {
 	return get(el);
 }
 
-sparse_vector& sparse_vector::operator*=(const double &v)
+template <typename V, typename I>
+basic_sparse_vector<V, I>& basic_sparse_vector<V, I>::operator*=(const double &v)
 {
-	auto value = v;
-	if (v == 0) data.clear();
+	if (v == 0) clear();
 	else
-		for (int i = 0; i < size(); i++)
-			mul(i, value);
+		for (I k = 0; k < values.size(); k++)
+			values[k] *= v;
 	return *this;
 }
 
-sparse_vector &sparse_vector::operator+=(const double &v)
+template <typename V, typename I>
+basic_sparse_vector<V, I> &basic_sparse_vector<V, I>::operator+=(const double &v)
 {
-	auto value = v;
 	if (v == 0) return *this;
-	for (int i = 0; i < size(); i++)
-		add(i, value);
+	*this = shift(v);
 	clean();
 	return *this;
 }
 
-sparse_vector &sparse_vector::operator-=(const double &v)
+template <typename V, typename I>
+basic_sparse_vector<V, I> &basic_sparse_vector<V, I>::operator-=(const double &v)
 {
-	auto value = v;
 	if (v == 0) return *this;
-	for (int i = 0; i < size(); i++)
-		sub(i, value);
+	*this = shift(-v);
 	clean();
 	return *this;
 }
 
-sparse_vector &sparse_vector::operator/=(const double &v)
+template <typename V, typename I>
+basic_sparse_vector<V, I> &basic_sparse_vector<V, I>::operator/=(const double &v)
 {
-	auto value = v;
 	if (v == 0)
 		throw std::runtime_error("division by zero");
-	for (int i = 0; i < size(); i++)
-		div(i, value);
+	for (I k = 0; k < values.size(); k++)
+		values[k] /= v;
 	return *this;
 }
 
-sparse_vector& sparse_vector::operator+=(const sparse_vector &v)
+template <typename V, typename I>
+basic_sparse_vector<V, I>& basic_sparse_vector<V, I>::operator+=(const basic_sparse_vector<V, I> &v)
 {
 	assert(length == v.size());
-	for(auto it=v.cbegin(); it != v.cend(); it++)
-		this->add(*it);
+	*this = merge(v, 1.0);
 	return *this;
 }
 
-sparse_vector& sparse_vector::operator-=(const sparse_vector &v)
+template <typename V, typename I>
+basic_sparse_vector<V, I>& basic_sparse_vector<V, I>::operator-=(const basic_sparse_vector<V, I> &v)
 {
 	assert(length == v.size());
-	for(auto it=v.cbegin(); it != v.cend(); it++)
-		this->sub(*it);
+	*this = merge(v, -1.0);
 	return *this;
 }
 
-bool sparse_vector::operator==(const sparse_vector &v) const
+template <typename V, typename I>
+bool basic_sparse_vector<V, I>::operator==(const basic_sparse_vector<V, I> &v) const
 {
 	try
 	{
-		for (int i = 0; i < length; i++)
+		for (I i = 0; i < length; i++)
 		{
 			double diff = (*this)[i] - v[i];
 			if (fabs(diff) > 0.01) return false;
@@ -186,9 +210,10 @@ bool sparse_vector::operator==(const sparse_vector &v) const
 	}
 }
 
-bool sparse_vector::operator!=(const sparse_vector &v) const
+template <typename V, typename I>
+bool basic_sparse_vector<V, I>::operator!=(const basic_sparse_vector<V, I> &v) const
 {
 	return !(*this == v);
 }
 
-
+INSTANTIATE_SPARSE(basic_sparse_vector)
@@ -3,21 +3,65 @@
 #include "../mpimatrix.h"
 #include "../generator.h"
 #include "../dense_matrix.h"
+#include "../sell_matrix.h"
+#include "../bcsr_matrix.h"
+#include "../mpi_types.h"
+#include "../trian_matrix.h"
+#include "../arena.h"
 #include <ctime>
+#include <fstream>
+#include <map>
+#include <algorithm>
 #include <unistd.h>
+#include <math.h>
 
 #define RANDOM_TESTS_COUNT 2
 #define MATRIX_SIZE 600
 
 #define TEST_ADD 1
 #define TEST_MUL 1
-#define TEST_LU 0
+#define TEST_LU 1
+#define TEST_CG 1
+#define TEST_TRANSPOSED 1
+#define TEST_SELL 1
+#define TEST_BCSR 1
+#define TEST_TYPES 1
+#define TEST_CHUNKED 1
+#define TEST_CG_MIXED 1
+#define TEST_TRIAN 1
+#define TEST_ILU 1
+#define TEST_ILU_FILL 1
+#define TEST_IC 1
+#define TEST_CG_SPLIT 1
+#define TEST_MULTICOLOR 1
+#define TEST_ARENA 1
+
+// Builds symmetric, diagonally dominant (hence SPD) matrix B + B^T + D
+sparse_matrix make_spd(const sparse_matrix &B)
+{
+    auto raw_data = B.getRawData();
+    vector<sparse_matrix_elem> elements;
+    vector<double> diagonal(B.getWidth(), 1.0);
+    for (auto it = raw_data.begin(); it != raw_data.end(); it++)
+    {
+        if (it->col == it->row) continue;
+        elements.push_back(sparse_matrix_elem{it->col, it->row, it->value});
+        elements.push_back(sparse_matrix_elem{it->row, it->col, it->value});
+        diagonal[it->col] += fabs(it->value);
+        diagonal[it->row] += fabs(it->value);
+    }
+    sparse_matrix result(elements, B.getWidth(), B.getHeight(), B.getDir());
+    vector<sparse_matrix_elem> diagonal_elements;
+    for (int i = 0; i < B.getWidth(); i++)
+        diagonal_elements.push_back(sparse_matrix_elem{i, i, diagonal[i]});
+    return result + sparse_matrix(diagonal_elements, B.getWidth(), B.getHeight(), B.getDir());
+}
 
 bool test_multiplication(int rank, int size, double &mpi_duration, double &normal_duration)
 {
     std::clock_t start;
     bool test_result = false;
-    MpiMatrixHelper helper(rank, size);
+    MpiMatrixHelper helper(rank, size, 2);
     mpi_duration = 0;
     normal_duration = 0;
 
@@ -31,6 +75,14 @@ bool test_multiplication(int rank, int size, double &mpi_duration, double &norma
       auto sparse_result = helper.mul(test_matrix_1, test_matrix_2);
       mpi_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
 
+      // Products of a non-square matrix take its height
+      auto wide = gen.GenerateRandomMatrix(MATRIX_SIZE, MATRIX_SIZE / 2, 4*MATRIX_SIZE, column_wise);
+      sparse_vector x(MATRIX_SIZE, column_wise);
+      for(int j = 0; j < MATRIX_SIZE; j++)
+        x.set(j, j % 5 - 2);
+      auto wide_sparse = helper.mul(wide, x);
+      auto wide_dense = helper.mul(wide, dense_vector(x));
+
       if (rank == 0)
       {
         dense_matrix actual(sparse_result);
@@ -56,7 +108,10 @@ bool test_multiplication(int rank, int size, double &mpi_duration, double &norma
             expected.printDense();
         }
 
-        test_result = (expected == actual);
+        auto wide_expected = wide * x;
+        test_result = (expected == actual) &&
+                      wide_sparse.size() == MATRIX_SIZE / 2 && wide_sparse == wide_expected &&
+                      wide_dense.toSparse() == wide_expected;
       }
 
       MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
@@ -112,7 +167,15 @@ bool test_addition(int rank, int size, double &mpi_duration, double &normal_dura
             expected.printDense();
         }
 
-        test_result = (expected == actual);
+        // Reading a missing item of a vector does not store it
+        sparse_vector v(MATRIX_SIZE, column_wise);
+        double missing = v[1];
+        v[2] = 3;
+        v[2] += 1;
+        v[3] = 5;
+        v[3] = 0;
+        test_result = (expected == actual) &&
+                      missing == 0 && v.getNnz() == 1 && v.get(2) == 4;
       }
 
       MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
@@ -124,11 +187,790 @@ bool test_addition(int rank, int size, double &mpi_duration, double &normal_dura
     return true;
 }
 
+// Products with a transposed view against products with the built transposition
+bool test_transposed(int rank, int size, double &mpi_duration, double &normal_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    MpiMatrixHelper helper(rank, size, 2);
+    mpi_duration = 0;
+    normal_duration = 0;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto A = gen.GenerateRandomMatrix(MATRIX_SIZE, MATRIX_SIZE, 2*MATRIX_SIZE, column_wise);
+      auto B = gen.GenerateRandomMatrix(MATRIX_SIZE, MATRIX_SIZE, 2*MATRIX_SIZE, row_wise);
+      // Only the left operand symmetric
+      auto S = make_spd(A);
+      auto A_sym = S.toSymmetric();
+      sparse_vector x(MATRIX_SIZE, column_wise);
+      for(int j = 0; j < MATRIX_SIZE; j++)
+        x.set(j, j % 7 - 3);
+
+      start = std::clock();
+      auto product = helper.mul(A, B.transposed());
+      auto symmetric_product = helper.mul(A_sym, B.transposed());
+      auto y = helper.mul(A.transposed(), x);
+      auto y_dense = helper.mul(B.transposed(), dense_vector(x));
+      mpi_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+      if (rank == 0)
+      {
+        sparse_matrix A_T(A), B_T(B);
+        start = std::clock();
+        A_T.transpose();
+        B_T.transpose();
+        normal_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+        // Viewed matrix compressed against the left operand
+        sparse_matrix B_col(B);
+        B_col.toggleDir();
+
+        test_result = dense_matrix(product) == dense_matrix(A * B_T) &&
+                      dense_matrix(A.multiply(B_col.transposed(), 2)) == dense_matrix(A * B_T) &&
+                      dense_matrix(symmetric_product) == dense_matrix(S * B_T) &&
+                      dense_matrix(A_sym * B.transposed()) == dense_matrix(S * B_T) &&
+                      y == A_T * x &&
+                      y_dense.toSparse() == B_T * x;
+      }
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    mpi_duration /= RANDOM_TESTS_COUNT;
+    normal_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+// SpMV on SELL-C-sigma storage against SpMV on compressed storage
+bool test_sell(int rank, int size, double &sell_duration, double &normal_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    sell_duration = 0;
+    normal_duration = 0;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto A = gen.GenerateRandomMatrix(MATRIX_SIZE, MATRIX_SIZE - 3, 10*MATRIX_SIZE, column_wise);
+
+      if (rank == 0)
+      {
+        sell_matrix A_sell(A);
+        dense_vector x(MATRIX_SIZE);
+        for(int j = 0; j < MATRIX_SIZE; j++)
+          x[j] = j % 7 - 3;
+
+        start = std::clock();
+        auto actual = A_sell.multiply(x, 2);
+        sell_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+        start = std::clock();
+        auto expected = A.multiply(x, 2);
+        normal_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+        test_result = (actual.toSparse() == expected.toSparse());
+      }
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    sell_duration /= RANDOM_TESTS_COUNT;
+    normal_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+// Matrix of random dense 3 x 3 blocks, like the ones of structural meshes
+sparse_matrix make_blocked(const sparse_matrix &pattern)
+{
+    auto raw_data = pattern.getRawData();
+    vector<sparse_matrix_elem> elements;
+    for (auto it = raw_data.begin(); it != raw_data.end(); it++)
+      for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+          elements.push_back(sparse_matrix_elem{3 * it->col + c, 3 * it->row + r, it->value + r - c + 0.5});
+    return sparse_matrix(elements, 3 * pattern.getWidth(), 3 * pattern.getHeight(), pattern.getDir());
+}
+
+// SpMV and SpGEMM on BCSR storage against compressed storage
+bool test_bcsr(int rank, int size, double &bcsr_duration, double &normal_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    bcsr_duration = 0;
+    normal_duration = 0;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto pattern = gen.GenerateRandomMatrix(MATRIX_SIZE / 3, MATRIX_SIZE / 3, MATRIX_SIZE, column_wise);
+
+      if (rank == 0)
+      {
+        // Sizes of a loaded matrix come from its last items
+        int corner = MATRIX_SIZE / 3 - 1;
+        auto A = make_blocked(pattern + sparse_matrix(vector<sparse_matrix_elem>{{corner, corner, 1}},
+                                                      corner + 1, corner + 1, column_wise));
+        bcsr_matrix<3, 3> A_bcsr(A);
+        dense_vector x(A.getWidth());
+        for(int j = 0; j < A.getWidth(); j++)
+          x[j] = j % 7 - 3;
+
+        start = std::clock();
+        auto actual = A_bcsr.multiply(x, 2);
+        auto actual_product = A_bcsr.multiply(A_bcsr, 2);
+        bcsr_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+        start = std::clock();
+        auto expected = A.multiply(x, 2);
+        auto expected_product = A.multiply(A, 2);
+        normal_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+        // 7 x 7 blocks stick out of the matrix on both sides
+        bcsr_matrix<7, 7> A_7x7(A);
+
+        // Loading picks the storage of the detected block size
+        const char *path = "test_bcsr.mtx";
+        std::ofstream file(path);
+        auto raw_data = A.getRawData();
+        for (auto it = raw_data.begin(); it != raw_data.end(); it++)
+          file << it->col << " " << it->row << " " << it->value << "\n";
+        file.close();
+        auto loaded = block_matrix::fromSparseFile(path);
+        remove(path);
+        auto unblocked = block_matrix::create(pattern);
+
+        test_result = A.detectBlockSize() == 3 &&
+                      loaded->getBlockSize() == 3 && loaded->getBlockCount() == A_bcsr.getBlockCount() &&
+                      loaded->multiply(x, 2).toSparse() == expected.toSparse() &&
+                      unblocked->getBlockSize() == 1 &&
+                      dense_matrix(unblocked->toSparse()) == dense_matrix(pattern) &&
+                      actual.toSparse() == expected.toSparse() &&
+                      A_7x7.multiply(x, 2).toSparse() == expected.toSparse() &&
+                      dense_matrix(actual_product.toSparse()) == dense_matrix(expected_product);
+      }
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    bcsr_duration /= RANDOM_TESTS_COUNT;
+    normal_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+// Single precision values at 64-bit positions against the double/int matrix
+bool test_types(int rank, int size, double &narrow_duration, double &normal_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    narrow_duration = 0;
+    normal_duration = 0;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto A = gen.GenerateRandomMatrix(MATRIX_SIZE, MATRIX_SIZE, 10*MATRIX_SIZE, column_wise);
+
+      if (rank == 0)
+      {
+        auto A_float = A.convert<float, int64_t>();
+        dense_vector x(MATRIX_SIZE);
+        for(int j = 0; j < MATRIX_SIZE; j++)
+          x[j] = j % 7 - 3;
+
+        start = std::clock();
+        auto actual = A_float.multiply(x, 2);
+        auto actual_product = A_float.multiply(A_float, 2);
+        narrow_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+        start = std::clock();
+        auto expected = A.multiply(x, 2);
+        auto expected_product = A.multiply(A, 2);
+        normal_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+        auto diff = actual - expected;
+        auto product_diff = actual_product.convert<double, int>() - expected_product;
+        double max_diff = 0;
+        for (auto it = product_diff.getValues().begin(); it != product_diff.getValues().end(); it++)
+          max_diff = std::max(max_diff, fabs(*it));
+        test_result = diff.l2_norm() <= 1e-5 * expected.l2_norm() &&
+                      max_diff <= 1e-3 &&
+                      A_float.getNnz() == A.getNnz();
+      }
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    narrow_duration /= RANDOM_TESTS_COUNT;
+    normal_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+bool test_cg(int rank, int size, double &mpi_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    // Two threads per rank to go through the threaded kernels as well
+    MpiMatrixHelper helper(rank, size, 2);
+    mpi_duration = 0;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto A = make_spd(gen.GenerateRandomMatrix(MATRIX_SIZE, MATRIX_SIZE, 2*MATRIX_SIZE, column_wise));
+
+      // b = A * (1, 1, ..., 1)
+      sparse_vector expected(MATRIX_SIZE, column_wise);
+      for(int j = 0; j < MATRIX_SIZE; j++)
+        expected.set(j, 1);
+      sparse_vector b;
+      if (rank == 0) b = A * expected;
+
+      start = std::clock();
+      auto x = helper.CG(A, b);
+      mpi_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+      // The same system with only the lower triangle stored
+      auto x_symmetric = helper.CG(A.toSymmetric(), b);
+
+      if (rank == 0)
+        test_result = (x == expected) && (x_symmetric == expected);
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    mpi_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+// Arrays longer than mpi_max_count() go in several messages - lowering it
+// on every rank makes all transfers of the helper go in pieces
+bool test_chunked(int rank, int size, double &mpi_duration, double &normal_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    MpiMatrixHelper helper(rank, size, 2);
+    Generator gen(rank, size);
+    auto A = gen.GenerateRandomMatrix(MATRIX_SIZE, MATRIX_SIZE, 40*MATRIX_SIZE, column_wise);
+    auto B = gen.GenerateRandomMatrix(MATRIX_SIZE, MATRIX_SIZE, 40*MATRIX_SIZE, row_wise);
+    sparse_vector x(MATRIX_SIZE, column_wise);
+    for(int j = 0; j < MATRIX_SIZE; j++)
+      x.set(j, j % 5 - 2);
+
+    size_t max_count = mpi_max_count();
+    mpi_max_count() = 7;
+    start = std::clock();
+    auto product = helper.mul(A, B);
+    auto sum = helper.add(A, B);
+    auto sparse_result = helper.mul(A, x);
+    auto dense_result = helper.mul(A, dense_vector(x));
+    mpi_duration = ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+    mpi_max_count() = max_count;
+
+    if (rank == 0)
+    {
+      start = std::clock();
+      auto expected = A * B;
+      normal_duration = ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+      auto expected_x = A * x;
+      test_result = dense_matrix(product) == dense_matrix(expected) &&
+                    dense_matrix(sum) == dense_matrix(A) + dense_matrix(B) &&
+                    sparse_result == expected_x && dense_result.toSparse() == expected_x;
+    }
+
+    MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    return test_result;
+}
+
+// Single precision ILU factors still have to give a double precision residual
+bool test_cg_mixed(int rank, int size, double &mpi_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    MpiMatrixHelper helper(rank, size, 2);
+    mpi_duration = 0;
+    int n = MATRIX_SIZE;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto A = make_spd(gen.GenerateRandomMatrix(n, n, 2*n, column_wise));
+
+      // b = A * (1, 1, ..., 1)
+      sparse_vector expected(n, column_wise);
+      for(int j = 0; j < n; j++)
+        expected.set(j, 1);
+      sparse_vector b;
+      if (rank == 0) b = A * expected;
+
+      start = std::clock();
+      auto x = helper.CG_ILU_MIXED(A, b);
+      mpi_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+      if (rank == 0)
+      {
+        auto r = dense_vector(b) - A * dense_vector(x);
+        test_result = (x == expected) && r.l2_norm() <= 1e-6 * b.l2_norm();
+      }
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    mpi_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+// Triangle of m with the diagonal, as a matrix of its own
+sparse_matrix triangle_of(const sparse_matrix &m, triangle part)
+{
+    auto raw_data = m.getRawData();
+    vector<sparse_matrix_elem> elements;
+    for (auto it = raw_data.begin(); it != raw_data.end(); it++)
+        if (part == lower_triangle ? it->col <= it->row : it->col >= it->row)
+            elements.push_back(*it);
+    return sparse_matrix(elements, m.getWidth(), m.getHeight(), column_wise);
+}
+
+// Level scheduled substitution by threads against the sequential one, both
+// checked by multiplying back
+bool test_trian(int rank, int size, double &level_duration, double &normal_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    level_duration = 0;
+    normal_duration = 0;
+    // Few levels wide enough to be shared out to threads
+    int n = 20 * MATRIX_SIZE;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto A = make_spd(gen.GenerateRandomMatrix(n, n, n, row_wise));
+
+      if (rank == 0)
+      {
+        dense_vector b(n);
+        for(int j = 0; j < n; j++)
+          b[j] = j % 7 - 3;
+
+        test_result = true;
+        for (int part = lower_triangle; part <= upper_triangle; part++)
+        {
+          trian_matrix T(A, (triangle)part);
+
+          start = std::clock();
+          auto x_level = T.solve(b, 2);
+          level_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+          start = std::clock();
+          auto x = T.solve(b, 1);
+          normal_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+          auto back = triangle_of(A, (triangle)part) * x;
+          test_result = test_result && (x_level.toSparse() == x.toSparse()) &&
+                        (back.toSparse() == b.toSparse());
+        }
+
+        // Singular factors are refused unless flagged as unit diagonal
+        sparse_matrix strict(vector<sparse_matrix_elem>{{0, 0, 2}, {0, 1, 3}}, 2, 2, column_wise);
+        sparse_matrix zero(vector<sparse_matrix_elem>{{0, 0, 2}, {0, 1, 3}, {1, 1, 0}}, 2, 2, column_wise);
+        int refused = 0;
+        for (auto m : {&strict, &zero})
+        {
+          try { trian_matrix T(*m, lower_triangle); }
+          catch (std::runtime_error &) { refused++; }
+        }
+        dense_vector unit_b(2);
+        unit_b[0] = 1;
+        unit_b[1] = 5;
+        auto unit = trian_matrix(strict, lower_triangle, true).solve(unit_b);
+        test_result = test_result && refused == 2 && unit[0] == 1 && unit[1] == 2;
+      }
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    level_duration /= RANDOM_TESTS_COUNT;
+    normal_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+// Incomplete factors reproduce A on its pattern - within blocks of rows and
+// columns [bounds[b], bounds[b+1]) - and have no items coupling two blocks
+bool ilu_matches(const sparse_matrix &A, const sparse_matrix &L, const sparse_matrix &U, const vector<int> &bounds)
+{
+    auto block = [&bounds](int i) { return std::upper_bound(bounds.begin(), bounds.end(), i) - bounds.begin(); };
+
+    std::map<std::pair<int, int>, double> product;
+    auto LU = L * U;
+    auto raw_product = LU.getRawData();
+    for (auto it = raw_product.begin(); it != raw_product.end(); it++)
+        product[std::make_pair(it->row, it->col)] = it->value;
+
+    auto raw_data = A.getRawData();
+    for (auto it = raw_data.begin(); it != raw_data.end(); it++)
+        if (block(it->row) == block(it->col) &&
+            fabs(product[std::make_pair(it->row, it->col)] - it->value) > 1e-9 * (1 + fabs(it->value)))
+            return false;
+
+    auto raw_l = L.getRawData(), raw_u = U.getRawData();
+    raw_l.insert(raw_l.end(), raw_u.begin(), raw_u.end());
+    for (auto it = raw_l.begin(); it != raw_l.end(); it++)
+        if (block(it->row) != block(it->col))
+            return false;
+    return true;
+}
+
+bool test_ilu(int rank, int size, double &mpi_duration, double &normal_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    MpiMatrixHelper helper(rank, size, 2);
+    mpi_duration = 0;
+    normal_duration = 0;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto A = make_spd(gen.GenerateRandomMatrix(MATRIX_SIZE, MATRIX_SIZE, 4*MATRIX_SIZE, column_wise));
+
+      sparse_matrix L, U, L_block, U_block;
+      start = std::clock();
+      helper.ILU(A, L, U);
+      normal_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+      start = std::clock();
+      helper.BlockILU(A, L_block, U_block);
+      mpi_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+      if (rank == 0)
+      {
+        vector<int> whole = {0, MATRIX_SIZE};
+        auto blocks = size > 1 ? A.splitBounds(size - 1) : whole;
+        test_result = ilu_matches(A, L, U, whole) && ilu_matches(A, L_block, U_block, blocks);
+      }
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    mpi_duration /= RANDOM_TESTS_COUNT;
+    normal_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+// Largest item of L * U - A
+double lu_error(const sparse_matrix &L, const sparse_matrix &U, const sparse_matrix &A)
+{
+    auto raw_data = (L * U - A).getRawData();
+    double error = 0;
+    for (auto it = raw_data.begin(); it != raw_data.end(); it++)
+        error = std::max(error, fabs(it->value));
+    return error;
+}
+
+// Complete LU fills in, so it is checked on a smaller matrix - the more
+// workers the more pivot columns come from other ones
+bool test_lu(int rank, int size, double &mpi_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    MpiMatrixHelper helper(rank, size, 2);
+    mpi_duration = 0;
+    int n = MATRIX_SIZE / 6;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto A = make_spd(gen.GenerateRandomMatrix(n, n, 2*n, column_wise));
+
+      sparse_matrix L, U;
+      start = std::clock();
+      helper.LU(A, L, U);
+      mpi_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+      // Fill-in smaller than 1e-6 is not stored, so L * U misses it
+      if (rank == 0)
+        test_result = lu_error(L, U, A) < 1e-3;
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    mpi_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+// ILU(k) and ILUT keeping all fill are complete LU, and both precondition CG
+bool test_ilu_fill(int rank, int size, double &mpi_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    MpiMatrixHelper helper(rank, size, 2);
+    mpi_duration = 0;
+    int n = MATRIX_SIZE / 2;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto A = make_spd(gen.GenerateRandomMatrix(n, n, 2*n, column_wise));
+
+      sparse_vector expected(n, column_wise);
+      for(int j = 0; j < n; j++)
+        expected.set(j, 1);
+      sparse_vector b;
+      if (rank == 0) b = A * expected;
+
+      start = std::clock();
+      auto x_level = helper.CG_ILU(A, b, ilu_options::iluk(2));
+      auto x_threshold = helper.CG_ILU(A, b, ilu_options::ilut(10, 1e-3));
+      mpi_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+      if (rank == 0)
+      {
+        auto level = ilu_matrix::iluk(A, n);
+        auto threshold = ilu_matrix::ilut(A, n, 0.0);
+        test_result = lu_error(level.getL(), level.getU(), A) < 1e-9 &&
+                      lu_error(threshold.getL(), threshold.getU(), A) < 1e-9 &&
+                      (x_level == expected) && (x_threshold == expected);
+      }
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    mpi_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+// Largest difference between L * L^T and A over the items of A
+double ic_error(const sparse_matrix &L, const sparse_matrix &LT, const sparse_matrix &A)
+{
+    std::map<std::pair<int, int>, double> product;
+    auto product_data = (L * LT).getRawData();
+    for (auto it = product_data.begin(); it != product_data.end(); it++)
+        product[std::make_pair(it->row, it->col)] = it->value;
+    auto raw_data = A.getRawData();
+    double error = 0;
+    for (auto it = raw_data.begin(); it != raw_data.end(); it++)
+        error = std::max(error, fabs(product[std::make_pair(it->row, it->col)] - it->value));
+    return error;
+}
+
+// IC(0) reproduces A on its pattern and preconditions CG, a matrix that
+// breaks it down is factorized shifted
+bool test_ic(int rank, int size, double &mpi_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    MpiMatrixHelper helper(rank, size, 2);
+    mpi_duration = 0;
+    int n = MATRIX_SIZE;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto A = make_spd(gen.GenerateRandomMatrix(n, n, 2*n, column_wise));
+
+      sparse_vector expected(n, column_wise);
+      for(int j = 0; j < n; j++)
+        expected.set(j, 1);
+      sparse_vector b;
+      if (rank == 0) b = A * expected;
+
+      start = std::clock();
+      auto x = helper.CG_IC(A, b);
+      mpi_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+      sparse_matrix L;
+      helper.IC(A, L, false);
+      sparse_matrix LT(L);
+      LT.transpose();
+
+      if (rank == 0)
+      {
+        auto factor = ic_matrix::ic0(A);
+        test_result = (x == expected) && factor.getShift() == 0 &&
+                      ic_error(factor.getL(), factor.getLT(), A) < 1e-9 &&
+                      ic_error(L, LT, A) < 1e-9;
+
+        // Pivot of the second row is 1 - 2 * 2 unless the diagonal grows
+        // past 2
+        sparse_matrix M(vector<sparse_matrix_elem>{{0, 0, 1}, {0, 1, 2}, {1, 0, 2}, {1, 1, 1}}, 2, 2, column_wise);
+        bool thrown = false;
+        try { ic_matrix::ic0(M); }
+        catch (std::runtime_error &) { thrown = true; }
+        auto shifted = ic_matrix::ic0_shifted(M);
+        double alpha = shifted.getShift();
+        sparse_matrix M_shifted(vector<sparse_matrix_elem>{{0, 0, 1 + alpha}, {0, 1, 2}, {1, 0, 2}, {1, 1, 1 + alpha}},
+                                2, 2, column_wise);
+        test_result = test_result && thrown && alpha > 1 && alpha < 4 &&
+                      ic_error(shifted.getL(), shifted.getLT(), M_shifted) < 1e-9;
+      }
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    mpi_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+// Split preconditioned CG solves with the factor of IC and with the L of ILU
+bool test_cg_split(int rank, int size, double &mpi_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    MpiMatrixHelper helper(rank, size, 2);
+    mpi_duration = 0;
+    int n = MATRIX_SIZE;
+
+    for(int i = 0; i < RANDOM_TESTS_COUNT; i++)
+    {
+      Generator gen(rank, size);
+      auto A = make_spd(gen.GenerateRandomMatrix(n, n, 2*n, column_wise));
+
+      sparse_vector expected(n, column_wise);
+      for(int j = 0; j < n; j++)
+        expected.set(j, 1);
+      sparse_vector b;
+      if (rank == 0) b = A * expected;
+
+      sparse_matrix L;
+      helper.IC(A, L);
+      start = std::clock();
+      auto x_ic = helper.CG_SPLIT(A, b, L);
+      mpi_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+      auto x_ilu = helper.CG_ILU_PRECONDITIONED(A, b);
+
+      if (rank == 0)
+        test_result = (x_ic == expected) && (x_ilu == expected);
+
+      MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      if(!test_result) return false;
+    }
+
+    mpi_duration /= RANDOM_TESTS_COUNT;
+    return true;
+}
+
+// 5-point Laplacian of an m x m mesh
+sparse_matrix poisson(int m)
+{
+    vector<sparse_matrix_elem> elements;
+    for (int i = 0; i < m * m; i++)
+    {
+        int r = i / m, c = i % m;
+        elements.push_back(sparse_matrix_elem{i, i, 4});
+        if (c > 0) elements.push_back(sparse_matrix_elem{i - 1, i, -1});
+        if (c < m - 1) elements.push_back(sparse_matrix_elem{i + 1, i, -1});
+        if (r > 0) elements.push_back(sparse_matrix_elem{i - m, i, -1});
+        if (r < m - 1) elements.push_back(sparse_matrix_elem{i + m, i, -1});
+    }
+    return sparse_matrix(elements, m * m, m * m, column_wise);
+}
+
+// Multicolor ordering leaves factors of a mesh two levels deep and still
+// preconditions CG; a random matrix is reordered item by item
+bool test_multicolor(int rank, int size, double &mpi_duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+    MpiMatrixHelper helper(rank, size, 2);
+    mpi_duration = 0;
+    int m = 30, n = m * m;
+    sparse_matrix A;
+    if (rank == 0) A = poisson(m);
+
+    sparse_vector expected(n, column_wise);
+    for(int j = 0; j < n; j++)
+      expected.set(j, 1);
+    sparse_vector b;
+    if (rank == 0) b = A * expected;
+
+    start = std::clock();
+    auto x_ilu = helper.CG_ILU(A, b, ilu_options::ilu0(), true);
+    auto x_ic = helper.CG_IC(A, b, true, true);
+    mpi_duration += ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+    if (rank == 0)
+    {
+      int colors = 0;
+      auto order = A.multicolorOrder(&colors);
+      auto P = A.permuted(order);
+      auto factors = ilu_matrix::ilu0(P);
+      trian_matrix L(factors.getL(), lower_triangle, true), U(factors.getU(), upper_triangle);
+      test_result = colors == 2 && L.getLevels() == 2 && U.getLevels() == 2 &&
+                    (x_ilu == expected) && (x_ic == expected);
+
+      Generator gen(rank, size);
+      auto B = gen.GenerateRandomMatrix(MATRIX_SIZE, MATRIX_SIZE, 4*MATRIX_SIZE, row_wise);
+      auto B_order = B.multicolorOrder();
+      auto B_p = B.permuted(B_order);
+      auto raw_data = B_p.getRawData();
+      for (auto it = raw_data.begin(); it != raw_data.end(); it++)
+        test_result = test_result && B.get(B_order[it->row], B_order[it->col]) == it->value;
+      test_result = test_result && B_p.getNnz() == B.getNnz();
+    }
+
+    MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    return test_result;
+}
+
+// Blocks are sized from the request alone, and once a scope rewinds past
+// them only ARENA_KEEP_SIZE bytes stay with the arena
+bool test_arena(int rank, int size, double &duration)
+{
+    std::clock_t start;
+    bool test_result = false;
+
+    if (rank == 0)
+    {
+      start = std::clock();
+      size_t large = 2 * ARENA_KEEP_SIZE;
+      arena a;
+      auto outer = a.getMark();
+      a.allocate(ARENA_BLOCK_SIZE / 2, 8);
+      auto inner = a.getMark();
+      a.allocate(large, 8);
+      bool sized = a.getReserved() == ARENA_BLOCK_SIZE + large + 8;
+      a.rewind(inner);
+      bool freed = a.getReserved() == ARENA_BLOCK_SIZE;
+      a.rewind(outer);
+      a.allocate(ARENA_BLOCK_SIZE / 2, 8);
+      bool kept = a.getReserved() == ARENA_BLOCK_SIZE;
+
+      // Building storage sorts items in scratch memory, 32 MB of them here
+      int n = 2048;
+      vector<sparse_matrix_elem> elements;
+      elements.reserve((size_t)n * n / 2);
+      for (int i = 0; i < n; i++)
+        for (int j = i % 2; j < n; j += 2)
+          elements.push_back(sparse_matrix_elem{j, i, 1.0});
+      sparse_matrix A(elements, n, n, column_wise);
+      duration = ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
+
+      test_result = sized && freed && kept && A.getNnz() == elements.size() &&
+                    scratch_arena().getReserved() <= ARENA_KEEP_SIZE;
+    }
+
+    MPI_Bcast(&test_result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    return test_result;
+}
+
 int main(int argc, char** argv)
 {
-    int rank, size;
+    int rank, size, provided;
 
-    MPI_Init(&argc,&argv);
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD,&rank);
     MPI_Comm_size(MPI_COMM_WORLD,&size);
 
@@ -161,6 +1003,185 @@ int main(int argc, char** argv)
             printf("test_addition [FAIL]\n");
     }
 
+    if(TEST_LU)
+    if(test_lu(rank, size, mpi_duration))
+    {
+        if(rank == 0)
+            printf("test_lu [SUCCESS] | time mpi=%f\n", mpi_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_lu [FAIL]\n");
+    }
+
+    if(TEST_CG)
+    if(test_cg(rank, size, mpi_duration))
+    {
+        if(rank == 0)
+            printf("test_cg [SUCCESS] | time mpi=%f\n", mpi_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_cg [FAIL]\n");
+    }
+
+    if(TEST_TRANSPOSED)
+    if(test_transposed(rank, size, mpi_duration, normal_duration))
+    {
+        if(rank == 0)
+            printf("test_transposed [SUCCESS] | time mpi=%f, transpose=%f\n", mpi_duration, normal_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_transposed [FAIL]\n");
+    }
+
+    if(TEST_SELL)
+    if(test_sell(rank, size, mpi_duration, normal_duration))
+    {
+        if(rank == 0)
+            printf("test_sell [SUCCESS] | time sell=%f, csc=%f\n", mpi_duration, normal_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_sell [FAIL]\n");
+    }
+
+    if(TEST_BCSR)
+    if(test_bcsr(rank, size, mpi_duration, normal_duration))
+    {
+        if(rank == 0)
+            printf("test_bcsr [SUCCESS] | time bcsr=%f, csc=%f\n", mpi_duration, normal_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_bcsr [FAIL]\n");
+    }
+
+    if(TEST_TYPES)
+    if(test_types(rank, size, mpi_duration, normal_duration))
+    {
+        if(rank == 0)
+            printf("test_types [SUCCESS] | time float=%f, double=%f\n", mpi_duration, normal_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_types [FAIL]\n");
+    }
+
+    if(TEST_CHUNKED)
+    if(test_chunked(rank, size, mpi_duration, normal_duration))
+    {
+        if(rank == 0)
+            printf("test_chunked [SUCCESS] | time mpi=%f, normal=%f\n", mpi_duration, normal_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_chunked [FAIL]\n");
+    }
+    if(TEST_CG_MIXED)
+    if(test_cg_mixed(rank, size, mpi_duration))
+    {
+        if(rank == 0)
+            printf("test_cg_mixed [SUCCESS] | time mpi=%f\n", mpi_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_cg_mixed [FAIL]\n");
+    }
+
+    if(TEST_TRIAN)
+    if(test_trian(rank, size, mpi_duration, normal_duration))
+    {
+        if(rank == 0)
+            printf("test_trian [SUCCESS] | time level=%f, sequential=%f\n", mpi_duration, normal_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_trian [FAIL]\n");
+    }
+
+    if(TEST_ILU)
+    if(test_ilu(rank, size, mpi_duration, normal_duration))
+    {
+        if(rank == 0)
+            printf("test_ilu [SUCCESS] | time block=%f, whole=%f\n", mpi_duration, normal_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_ilu [FAIL]\n");
+    }
+
+    if(TEST_ILU_FILL)
+    if(test_ilu_fill(rank, size, mpi_duration))
+    {
+        if(rank == 0)
+            printf("test_ilu_fill [SUCCESS] | time mpi=%f\n", mpi_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_ilu_fill [FAIL]\n");
+    }
+
+    if(TEST_IC)
+    if(test_ic(rank, size, mpi_duration))
+    {
+        if(rank == 0)
+            printf("test_ic [SUCCESS] | time mpi=%f\n", mpi_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_ic [FAIL]\n");
+    }
+
+    if(TEST_CG_SPLIT)
+    if(test_cg_split(rank, size, mpi_duration))
+    {
+        if(rank == 0)
+            printf("test_cg_split [SUCCESS] | time mpi=%f\n", mpi_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_cg_split [FAIL]\n");
+    }
+
+    if(TEST_MULTICOLOR)
+    if(test_multicolor(rank, size, mpi_duration))
+    {
+        if(rank == 0)
+            printf("test_multicolor [SUCCESS] | time mpi=%f\n", mpi_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_multicolor [FAIL]\n");
+    }
+
+    if(TEST_ARENA)
+    if(test_arena(rank, size, mpi_duration))
+    {
+        if(rank == 0)
+            printf("test_arena [SUCCESS] | time=%f\n", mpi_duration);
+    }
+    else
+    {
+        if(rank == 0)
+            printf("test_arena [FAIL]\n");
+    }
+
     MPI_Finalize();
     return 0;
 }
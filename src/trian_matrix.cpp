@@ -0,0 +1,151 @@
+#include "trian_matrix.h"
+#include "arena.h"
+#include <stdexcept>
+#include <algorithm>
+
+// CONSTRUCTORS
+
+template <typename V, typename I>
+basic_trian_matrix<V, I>::basic_trian_matrix()
+		: size(0), part(lower_triangle), unit_diagonal(false), ptr(1, 0), level_ptr(1, 0)
+{ }
+
+template <typename V, typename I>
+basic_trian_matrix<V, I>::basic_trian_matrix(const matrix_type &m, triangle part, bool unit_diagonal)
+		: size(m.getHeight()), part(part), unit_diagonal(unit_diagonal), ptr(1, 0), inv_diag(m.getHeight(), 1.0)
+{
+	if (m.getWidth() != m.getHeight())
+		throw std::runtime_error("Triangular matrix must be square");
+
+	// Items are read row by row
+	matrix_type row_matrix(m.isSymmetric() ? m.toGeneral() : m.toDir(row_wise));
+	if (row_matrix.getDir() != row_wise) row_matrix.toggleDir();
+	auto &m_ptr = row_matrix.getPtr();
+	auto &m_idx = row_matrix.getIdx();
+	auto &m_values = row_matrix.getValues();
+
+	ptr.reserve(size + 1);
+	for (I i = 0; i < size; i++)
+	{
+		bool has_diag = unit_diagonal;
+		for (sparse_offset k = m_ptr[i]; k < m_ptr[i + 1]; k++)
+		{
+			I j = m_idx[k];
+			if (j == i)
+			{
+				if (unit_diagonal) continue;
+				if (m_values[k] == 0)
+					throw std::runtime_error("Zero on the diagonal of triangular matrix");
+				inv_diag[i] = 1.0 / m_values[k];
+				has_diag = true;
+			}
+			else if (part == lower_triangle ? j < i : j > i)
+			{
+				idx.push_back(j);
+				values.push_back(m_values[k]);
+			}
+		}
+		if (!has_diag)
+			throw std::runtime_error("Missing diagonal of triangular matrix");
+		ptr.push_back(idx.size());
+	}
+
+	// Rows are visited in substitution order, so levels of the rows read
+	// are known already
+	arena_scope scope;
+	scratch_vector<I> level(size, 0, scope);
+	I levels = 0;
+	for (I t = 0; t < size; t++)
+	{
+		I i = part == lower_triangle ? t : size - 1 - t;
+		I l = 0;
+		for (sparse_offset k = ptr[i]; k < ptr[i + 1]; k++)
+			l = std::max(l, level[idx[k]] + 1);
+		level[i] = l;
+		levels = std::max(levels, l + 1);
+	}
+
+	level_ptr.assign(levels + 1, 0);
+	for (I i = 0; i < size; i++)
+		level_ptr[level[i] + 1]++;
+	for (I l = 0; l < levels; l++)
+		level_ptr[l + 1] += level_ptr[l];
+
+	level_rows.resize(size);
+	scratch_vector<I> next(level_ptr.begin(), level_ptr.end() - 1, scope);
+	for (I t = 0; t < size; t++)
+	{
+		I i = part == lower_triangle ? t : size - 1 - t;
+		level_rows[next[level[i]]++] = i;
+	}
+}
+
+// METHODS
+
+template <typename V, typename I>
+inline double basic_trian_matrix<V, I>::solveRow(I i, const double *b, const double *x) const
+{
+	double sum = b[i];
+	for (sparse_offset k = ptr[i]; k < ptr[i + 1]; k++)
+		sum -= values[k] * x[idx[k]];
+	return sum * inv_diag[i];
+}
+
+template <typename V, typename I>
+dense_vector basic_trian_matrix<V, I>::solve(const dense_vector &b, int threads) const
+{
+	if (b.size() != size)
+		throw std::runtime_error("Dimensions of matrix and vector do not match");
+
+	dense_vector x(size, b.getDir());
+	solve(b.getData(), x.getData(), threads);
+	return x;
+}
+
+// Row i reads b[i] and rows solved before it only, so x may overwrite b
+template <typename V, typename I>
+void basic_trian_matrix<V, I>::solve(const double *b, double *x, int threads) const
+{
+	I levels = getLevels();
+	if (threads <= 1 || size < (int64_t)levels * TRIAN_LEVEL_ROWS)
+	{
+		// Long chains of dependent rows go in plain substitution order
+		for (I t = 0; t < size; t++)
+		{
+			I i = part == lower_triangle ? t : size - 1 - t;
+			x[i] = solveRow(i, b, x);
+		}
+		return;
+	}
+
+	#pragma omp parallel num_threads(threads)
+	for (I l = 0; l < levels; l++)
+	{
+		#pragma omp for schedule(static)
+		for (I r = level_ptr[l]; r < level_ptr[l + 1]; r++)
+		{
+			I i = level_rows[r];
+			x[i] = solveRow(i, b, x);
+		}
+	}
+}
+
+// GETTERS
+
+template <typename V, typename I>
+I basic_trian_matrix<V, I>::getSize() const
+{ return size; }
+
+template <typename V, typename I>
+triangle basic_trian_matrix<V, I>::getPart() const
+{ return part; }
+
+template <typename V, typename I>
+bool basic_trian_matrix<V, I>::hasUnitDiagonal() const
+{ return unit_diagonal; }
+
+template <typename V, typename I>
+I basic_trian_matrix<V, I>::getLevels() const
+{ return level_ptr.size() - 1; }
+
+INSTANTIATE_SPARSE(basic_trian_matrix)
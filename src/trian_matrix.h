@@ -0,0 +1,69 @@
+#ifndef MPI_MATRICES_TRIAN_MATRIX_H
+#define MPI_MATRICES_TRIAN_MATRIX_H
+
+#include <vector>
+#include "sparse_matrix.h"
+#include "dense_vector.h"
+
+// Rows a level needs on average to be shared out to threads. A row of a
+// factor takes a few nanoseconds, a barrier per level microseconds - the
+// levels of a naturally ordered 2D mesh (about sqrt(n) / 2 rows) never get
+// there. Factors of a multicolor ordered matrix have a level per color.
+#define TRIAN_LEVEL_ROWS 1024
+
+enum triangle { lower_triangle, upper_triangle };
+
+// Triangular factor prepared for repeated substitution. The analysis runs
+// once: off-diagonal items are kept compressed by rows, the diagonal is kept
+// inverted aside, and rows are grouped in levels - a row lands one level past
+// the deepest row it reads, so rows of a level only read earlier levels and
+// are solved in parallel. Items on the other side of the diagonal are
+// ignored, so both factors can be taken from a single LU matrix. A unit
+// diagonal factor - the L of LU or ILU - may be flagged as one, then its
+// diagonal is not read; otherwise every row must store a nonzero diagonal.
+template <typename V, typename I>
+class basic_trian_matrix
+{
+public:
+	typedef V value_type;
+	typedef I index_type;
+	typedef basic_sparse_matrix<V, I> matrix_type;
+
+// FIELDS
+private:
+	I size;
+	triangle part;
+	bool unit_diagonal;
+
+	// Row i reads x[idx[k]] for k in [ptr[i], ptr[i+1])
+	std::vector<sparse_offset> ptr;
+	std::vector<I> idx;
+	std::vector<V> values;
+	std::vector<double> inv_diag;
+
+	// Level l holds rows level_rows[level_ptr[l]..level_ptr[l+1])
+	std::vector<I> level_ptr;
+	std::vector<I> level_rows;
+
+// CONSTRUCTORS
+public:
+	basic_trian_matrix();
+	basic_trian_matrix(const matrix_type &m, triangle part, bool unit_diagonal = false);
+
+// METHODS
+public:
+	dense_vector solve(const dense_vector &b, int threads = 1) const;
+	// x may be b itself
+	void solve(const double *b, double *x, int threads = 1) const;
+	I getSize() const;
+	triangle getPart() const;
+	bool hasUnitDiagonal() const;
+	I getLevels() const;
+
+private:
+	double solveRow(I i, const double *b, const double *x) const;
+};
+
+typedef basic_trian_matrix<double, int> trian_matrix;
+
+#endif //MPI_MATRICES_TRIAN_MATRIX_H